@@ -7,22 +7,215 @@
 #include <sys/wait.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/vfs.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/btrfs.h>
+#include <linux/magic.h>
+#include <linux/loop.h>
+#include <linux/fuse.h>
+#include <sys/uio.h>
+#include <sys/xattr.h>
+#include <dirent.h>
+#include <sys/utsname.h>
+#include <sys/mman.h>
+#include <elf.h>
+#include <sys/sysmacros.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <time.h>
 #include <sched.h>
+#include <pwd.h>
 #include <signal.h>
 #include <filesystem>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <cmath>
+#include <cstring>
 #include <curl/curl.h>
+#include <zlib.h>
 #include <archive.h>
 #include <archive_entry.h>
 
+// Where iza keeps images, overlays and container state: /var/lib/iza for
+// root, a per-user directory for rootless runs
+std::string iza_storage_root() {
+    if (geteuid() == 0) return "/var/lib/iza";
+    
+    const char* data_home = getenv("XDG_DATA_HOME");
+    if (data_home != nullptr && *data_home) return std::string(data_home) + "/iza";
+    const char* home = getenv("HOME");
+    return std::string(home != nullptr ? home : "/tmp") + "/.local/share/iza";
+}
+
+// Runs an external tool from PATH and waits; -1 unless it exits with 0
+int run_program(const std::vector<std::string>& argv) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        std::vector<char*> exec_args;
+        for (const auto& arg : argv) {
+            exec_args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        exec_args.push_back(nullptr);
+        execvp(exec_args[0], exec_args.data());
+        _exit(127);
+    }
+    
+    int status;
+    if (waitpid(pid, &status, 0) < 0) return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// A -v or --tmpfs mount, parsed from the command line
+struct MountSpec {
+    std::string source;                 // Host path; empty for tmpfs
+    std::string target;                 // Absolute path inside the container
+    unsigned long flags = 0;            // MS_RDONLY, MS_NOEXEC, ...
+    std::string data;                   // tmpfs options, e.g. "size=64m,mode=1777"
+};
+
+// "HOST:CONTAINER[:ro|rw]" for volumes, "PATH[:OPTIONS]" for tmpfs, where
+// OPTIONS are comma-separated tmpfs options plus ro, noexec, nosuid, nodev
+int parse_mount_spec(const std::string& spec, bool tmpfs, MountSpec& mount_spec, std::string& error) {
+    std::vector<std::string> parts;
+    std::stringstream ss(spec);
+    std::string part;
+    while (std::getline(ss, part, ':')) {
+        parts.push_back(part);
+    }
+    
+    std::string options;
+    if (tmpfs) {
+        if (parts.empty() || parts.size() > 2) {
+            error = "expected PATH[:OPTIONS]";
+            return -1;
+        }
+        mount_spec.target = parts[0];
+        options = parts.size() == 2 ? parts[1] : "";
+    } else {
+        if (parts.size() < 2 || parts.size() > 3) {
+            error = "expected HOST:CONTAINER[:ro]";
+            return -1;
+        }
+        mount_spec.source = parts[0];
+        mount_spec.target = parts[1];
+        options = parts.size() == 3 ? parts[2] : "";
+        
+        if (!mount_spec.source.starts_with("/")) {
+            error = "host path must be absolute";
+            return -1;
+        }
+    }
+    if (!mount_spec.target.starts_with("/") || mount_spec.target == "/") {
+        error = "container path must be absolute and not /";
+        return -1;
+    }
+    
+    std::stringstream option_list(options);
+    std::string option;
+    while (std::getline(option_list, option, ',')) {
+        if (option.empty() || option == "rw") continue;
+        if (option == "ro") mount_spec.flags |= MS_RDONLY;
+        else if (tmpfs && option == "noexec") mount_spec.flags |= MS_NOEXEC;
+        else if (tmpfs && option == "nosuid") mount_spec.flags |= MS_NOSUID;
+        else if (tmpfs && option == "nodev") mount_spec.flags |= MS_NODEV;
+        else if (tmpfs && (option.starts_with("size=") || option.starts_with("mode=") ||
+                           option.starts_with("nr_inodes=") || option.starts_with("uid=") ||
+                           option.starts_with("gid=") || option.starts_with("huge="))) {
+            mount_spec.data += (mount_spec.data.empty() ? "" : ",") + option;
+        } else {
+            error = "unknown option '" + option + "'";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Options --overlay-opts accepts, with the values each may take
+bool valid_overlay_option(const std::string& option) {
+    std::string name = option.substr(0, option.find('='));
+    std::string value = option.find('=') == std::string::npos ? "" : option.substr(option.find('=') + 1);
+    if (name == "volatile") return value.empty();
+    if (name == "metacopy" || name == "index") return value == "on" || value == "off";
+    if (name == "redirect_dir") return value == "on" || value == "off" || value == "follow" || value == "nofollow";
+    return false;
+}
+
 class Arguments {
 public:
-    std::string command_type = "";      // "run", "pull", "images"
+    std::string command_type = "";      // "run", "pull", "images", "topology", "stats", "slice", "prune", "update", "pause", "resume", "pool", "commit", "diff"
     std::string memory_limit = "";      // e.g., "100m", "1g"
     std::string cpu_limit = "";         // e.g., "1", "0.5"
+    std::string memory_high = "";       // Throttle above this, e.g., "80m"
+    std::string memory_low = "";        // Best-effort protection, e.g., "20m"
+    std::string memory_min = "";        // Hard protection, e.g., "10m"
+    std::string memory_swap = "";       // Swap limit, e.g., "0", "200m", "max"
+    std::string cpu_weight = "";        // Relative CPU share, 1-10000
+    std::string pids_limit = "";        // Max number of tasks, e.g., "256"
+    std::string cpuset_cpus = "";       // e.g., "0-3,8"
+    std::string cpuset_mems = "";       // e.g., "0"
+    std::string cpuset_mode = "";       // "auto" for topology-aware placement
+    std::vector<std::string> io_max;    // e.g., "/dev/sda:rbps=10m,wiops=100"
+    std::vector<std::string> io_weight; // e.g., "200", "/dev/sda:500"
     std::string image_name = "";        // e.g., "ubuntu:latest"
+    std::string image_format = "dir";   // pull: dir (extracted tree), erofs, squashfs or lazy
+    std::string image_url = "";         // pull --from: tarball URL instead of the built-in one
     std::vector<std::string> command;   // Command to run in container
+    std::string container_id = "";      // Target of stats, etc.
+    std::string stats_interval = "1";   // Seconds between samples
+    std::string output_format = "table"; // "table" or "json"
+    bool no_stream = false;             // Print one sample and exit
+    bool perf = false;                  // Add perf counters to stats
+    std::string pressure_threshold = "100"; // PSI stall ms per window before reporting
+    std::string pressure_action = "log";  // "log" or "relax" (raise memory.high)
+    std::string cgroup_parent = "";     // Parent cgroup, default iza.slice
+    bool force = false;                 // Allow limits below current usage
+    std::string cpu_adapt = "";         // Upper bound (cores) for the adaptive CPU quota
+    std::string cpu_burst_max = "";     // Upper bound (cores) for cpu.max.burst
+    std::string cpu_period_range = "10000:100000"; // MIN:MAX period in microseconds
+    std::vector<std::string> volumes;   // -v HOST:CONTAINER[:ro]
+    std::vector<std::string> tmpfs_mounts; // --tmpfs PATH[:OPTIONS]
+    std::string tmp_size = "";          // Size cap for /tmp, e.g. "512m" or "25%" (default: half of RAM)
+    std::string shm_size = "64m";       // Size of /dev/shm
+    std::string tmpfs_huge = "";        // huge= for /tmp and /dev/shm: never, always, within_size, advise
+    std::string overlay_opts = "";      // Extra overlay options: volatile, metacopy=, index=, redirect_dir=
+    std::string storage_driver = "";    // overlay, btrfs, reflink, copy; empty picks by filesystem
+    bool read_only = false;             // Read-only root; only --tmpfs/-v paths are writable
+    std::string rootfs_mode = "cache";  // Legacy rootfs: "cache" (overlay on a cached tree) or "bind"
+    std::string reclaim_step = "";      // Enables idle reclaim: bytes ("16m") or percent ("10%") per step
+    std::string reclaim_interval = "10"; // Idle seconds between reclaim steps
+    std::string idle_threshold = "2";   // CPU use (percent of one core) below which a container is idle
+    std::string pool_action = "";       // pool subcommand: start, take, stop, list
+    std::string pool_name = "";         // Warm pool this run belongs to
+    std::string pool_size = "";         // Containers to start for "pool start"
+    std::string ready_file = "";        // Path inside the container that signals readiness
+    std::vector<std::string> pool_run_args; // "iza run" arguments for pool members
     bool valid = false;
     
+    bool has_resource_limits() const {
+        return !memory_limit.empty() || !cpu_limit.empty() ||
+               !memory_high.empty() || !memory_low.empty() ||
+               !memory_min.empty() || !memory_swap.empty() ||
+               !cpu_weight.empty() || !pids_limit.empty() ||
+               !cpuset_cpus.empty() || !cpuset_mems.empty() ||
+               !cpuset_mode.empty() ||
+               !io_max.empty() || !io_weight.empty();
+    }
+    
     bool parse(int argc, char* argv[]) {
         if (argc < 2) {
             show_usage();
@@ -37,6 +230,24 @@ public:
             return parse_images_command(argc, argv);
         } else if (command_type == "run") {
             return parse_run_command(argc, argv);
+        } else if (command_type == "topology") {
+            return parse_topology_command(argc, argv);
+        } else if (command_type == "stats") {
+            return parse_stats_command(argc, argv);
+        } else if (command_type == "slice") {
+            return parse_slice_command(argc, argv);
+        } else if (command_type == "prune") {
+            return parse_prune_command(argc, argv);
+        } else if (command_type == "update") {
+            return parse_update_command(argc, argv);
+        } else if (command_type == "pause" || command_type == "resume") {
+            return parse_pause_command(argc, argv);
+        } else if (command_type == "pool") {
+            return parse_pool_command(argc, argv);
+        } else if (command_type == "commit") {
+            return parse_commit_command(argc, argv);
+        } else if (command_type == "diff") {
+            return parse_pause_command(argc, argv);
         } else {
             std::cerr << "Error: Unknown command '" << command_type << "'\n";
             show_usage();
@@ -46,12 +257,39 @@ public:
     
 private:
     bool parse_pull_command(int argc, char* argv[]) {
-        if (argc != 3) {
-            std::cerr << "Usage: iza pull IMAGE\n";
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--format" && i + 1 < argc) {
+                image_format = argv[++i];
+            } else if (arg.starts_with("--format=")) {
+                image_format = arg.substr(9);
+            } else if (arg == "--from" && i + 1 < argc) {
+                image_url = argv[++i];
+            } else if (!arg.starts_with("-") && image_name.empty()) {
+                image_name = arg;
+            } else {
+                image_name.clear();
+                break;
+            }
+        }
+        if (image_name.empty()) {
+            std::cerr << "Usage: iza pull [--format dir|erofs|squashfs|lazy] [--from URL] IMAGE\n";
             std::cerr << "Example: iza pull ubuntu:latest\n";
             return false;
         }
-        image_name = argv[2];
+        if (image_format != "dir" && image_format != "erofs" && image_format != "squashfs" && image_format != "lazy") {
+            std::cerr << "Error: Unknown image format '" << image_format << "' (supported: dir, erofs, squashfs, lazy)\n";
+            return false;
+        }
+        if (image_format != "dir" && geteuid() != 0) {
+            std::cerr << "Error: --format " << image_format << " images are "
+                      << (image_format == "lazy" ? "served from a FUSE mount" : "loop-mounted") << ", which needs root\n";
+            return false;
+        }
+        if (!image_url.empty() && (image_name.find('/') != std::string::npos || image_name.starts_with("."))) {
+            std::cerr << "Error: Image name '" << image_name << "' must not contain '/' or start with '.'\n";
+            return false;
+        }
         valid = true;
         return true;
     }
@@ -65,6 +303,157 @@ private:
         return true;
     }
     
+    bool parse_topology_command(int argc, char* argv[]) {
+        (void)argv;
+        if (argc != 2) {
+            std::cerr << "Usage: iza topology\n";
+            return false;
+        }
+        valid = true;
+        return true;
+    }
+    
+    bool parse_stats_command(int argc, char* argv[]) {
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            
+            if (arg == "--interval" && i + 1 < argc) {
+                stats_interval = argv[++i];
+            } else if (arg.starts_with("--interval=")) {
+                stats_interval = arg.substr(11);
+            } else if (arg == "--format" && i + 1 < argc) {
+                output_format = argv[++i];
+            } else if (arg.starts_with("--format=")) {
+                output_format = arg.substr(9);
+            } else if (arg == "--no-stream") {
+                no_stream = true;
+            } else if (arg == "--perf") {
+                perf = true;
+            } else if (!arg.starts_with("-") && container_id.empty()) {
+                container_id = arg;
+            } else {
+                std::cerr << "Usage: iza stats [--interval SECONDS] [--format table|json] [--no-stream] [--perf] [ID]\n";
+                return false;
+            }
+        }
+        
+        if (output_format != "table" && output_format != "json") {
+            std::cerr << "Error: Unknown format '" << output_format << "' (supported: table, json)\n";
+            return false;
+        }
+        
+        valid = true;
+        return true;
+    }
+    
+    bool parse_update_command(int argc, char* argv[]) {
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (parse_resource_option(argc, argv, i)) {
+                continue;
+            } else if (arg == "--force") {
+                force = true;
+            } else if (!arg.starts_with("-") && container_id.empty()) {
+                container_id = arg;
+            } else {
+                container_id.clear();
+                break;
+            }
+        }
+        
+        if (container_id.empty() || !has_resource_limits()) {
+            std::cerr << "Usage: iza update [--force] ID [--memory LIMIT] [--cpus N] [--pids N] [--io DEV:LIMITS] ...\n";
+            return false;
+        }
+        if (!cpuset_mode.empty()) {
+            std::cerr << "Error: --cpuset auto is only supported by iza run\n";
+            return false;
+        }
+        
+        valid = true;
+        return true;
+    }
+    
+    bool parse_pause_command(int argc, char* argv[]) {
+        if (argc != 3) {
+            std::cerr << "Usage: iza " << command_type << " ID\n";
+            return false;
+        }
+        container_id = argv[2];
+        valid = true;
+        return true;
+    }
+    
+    bool parse_pool_command(int argc, char* argv[]) {
+        if (argc >= 3) pool_action = argv[2];
+        
+        if (pool_action == "start" && argc >= 6) {
+            pool_name = argv[3];
+            pool_size = argv[4];
+            for (int i = 5; i < argc; i++) {
+                pool_run_args.push_back(argv[i]);
+            }
+        } else if ((pool_action == "take" || pool_action == "stop") && argc == 4) {
+            pool_name = argv[3];
+        } else if (pool_action == "list" && argc == 3) {
+            // Nothing else to parse
+        } else {
+            std::cerr << "Usage: iza pool start NAME SIZE [RUN OPTIONS] IMAGE [COMMAND]\n"
+                      << "       iza pool take NAME\n"
+                      << "       iza pool stop NAME\n"
+                      << "       iza pool list\n";
+            return false;
+        }
+        
+        valid = true;
+        return true;
+    }
+    
+    bool parse_commit_command(int argc, char* argv[]) {
+        if (argc != 4) {
+            std::cerr << "Usage: iza commit ID NAME[:TAG]\n";
+            return false;
+        }
+        container_id = argv[2];
+        image_name = argv[3];
+        if (image_name.find('/') != std::string::npos || image_name.starts_with(".")) {
+            std::cerr << "Error: Invalid image name '" << image_name << "'\n";
+            return false;
+        }
+        valid = true;
+        return true;
+    }
+    
+    bool parse_prune_command(int argc, char* argv[]) {
+        for (int i = 2; i < argc; i++) {
+            if (!parse_value_option(argc, argv, i, {{"--cgroup-parent", &cgroup_parent}})) {
+                std::cerr << "Usage: iza prune [--cgroup-parent PATH]\n";
+                return false;
+            }
+        }
+        valid = true;
+        return true;
+    }
+    
+    bool parse_slice_command(int argc, char* argv[]) {
+        for (int i = 2; i < argc; i++) {
+            if (parse_resource_option(argc, argv, i) ||
+                parse_value_option(argc, argv, i, {{"--cgroup-parent", &cgroup_parent}})) {
+                continue;
+            }
+            std::cerr << "Usage: iza slice [--cgroup-parent PATH] [--memory LIMIT] [--cpus N] [--pids-limit N] ...\n";
+            return false;
+        }
+        
+        if (!cpuset_mode.empty()) {
+            std::cerr << "Error: --cpuset auto only applies to containers\n";
+            return false;
+        }
+        
+        valid = true;
+        return true;
+    }
+    
     bool parse_run_command(int argc, char* argv[]) {
         if (argc < 3) {
             std::cerr << "Usage: iza run [OPTIONS] IMAGE|COMMAND [ARGS...]\n";
@@ -76,14 +465,34 @@ private:
         while (i < argc) {
             std::string arg = argv[i];
             
-            if (arg == "--memory" && i + 1 < argc) {
-                memory_limit = argv[++i];
-            } else if (arg == "--cpus" && i + 1 < argc) {
-                cpu_limit = argv[++i];
-            } else if (arg.starts_with("--memory=")) {
-                memory_limit = arg.substr(9);
-            } else if (arg.starts_with("--cpus=")) {
-                cpu_limit = arg.substr(7);
+            if (parse_resource_option(argc, argv, i)) {
+                // Consumed a resource limit flag
+            } else if (parse_value_option(argc, argv, i, {
+                           {"--pressure-threshold", &pressure_threshold},
+                           {"--on-pressure", &pressure_action},
+                           {"--cgroup-parent", &cgroup_parent},
+                           {"--rootfs-mode", &rootfs_mode},
+                           {"--tmp-size", &tmp_size},
+                           {"--shm-size", &shm_size},
+                           {"--tmpfs-huge", &tmpfs_huge},
+                           {"--overlay-opts", &overlay_opts},
+                           {"--storage-driver", &storage_driver},
+                           {"--cpu-adapt", &cpu_adapt},
+                           {"--cpu-burst-max", &cpu_burst_max},
+                           {"--cpu-period-range", &cpu_period_range},
+                           {"--reclaim-idle", &reclaim_step},
+                           {"--reclaim-interval", &reclaim_interval},
+                           {"--idle-threshold", &idle_threshold},
+                           {"--pool", &pool_name},
+                           {"--ready-file", &ready_file}})) {
+                // Consumed a monitoring, placement or feedback flag
+            } else if (arg == "--read-only") {
+                read_only = true;
+            } else if (parse_list_option(argc, argv, i, {
+                           {"-v", &volumes},
+                           {"--volume", &volumes},
+                           {"--tmpfs", &tmpfs_mounts}})) {
+                // Consumed a mount flag
             } else {
                 // Check if this looks like an image name (has : or is a known image)
                 if (arg.find(':') != std::string::npos || is_available_image(arg)) {
@@ -104,6 +513,81 @@ private:
             i++;
         }
         
+        if (pressure_action != "log" && pressure_action != "relax") {
+            std::cerr << "Error: Unknown --on-pressure action '" << pressure_action << "' (supported: log, relax)\n";
+            return false;
+        }
+        
+        for (const auto& [specs, tmpfs] : {std::pair{&volumes, false}, std::pair{&tmpfs_mounts, true}}) {
+            for (const auto& spec : *specs) {
+                MountSpec mount_spec;
+                std::string error;
+                if (parse_mount_spec(spec, tmpfs, mount_spec, error) != 0) {
+                    std::cerr << "Error: Invalid " << (tmpfs ? "--tmpfs" : "-v") << " '" << spec << "': " << error << "\n";
+                    return false;
+                }
+                if (!tmpfs && !std::filesystem::exists(mount_spec.source)) {
+                    std::cerr << "Error: Volume source " << mount_spec.source << " does not exist\n";
+                    return false;
+                }
+            }
+        }
+        
+        for (const auto& [flag, size] : {std::pair{"--tmp-size", tmp_size}, std::pair{"--shm-size", shm_size}}) {
+            if (!size.empty() && !valid_tmpfs_size(size)) {
+                std::cerr << "Error: Invalid " << flag << " '" << size << "' (e.g. 64m, 1g, 25%)\n";
+                return false;
+            }
+        }
+        
+        if (!tmpfs_huge.empty() && tmpfs_huge != "never" && tmpfs_huge != "always" &&
+            tmpfs_huge != "within_size" && tmpfs_huge != "advise") {
+            std::cerr << "Error: Unknown --tmpfs-huge '" << tmpfs_huge << "' (supported: never, always, within_size, advise)\n";
+            return false;
+        }
+        
+        std::stringstream overlay_list(overlay_opts);
+        std::string overlay_option;
+        while (std::getline(overlay_list, overlay_option, ',')) {
+            if (!overlay_option.empty() && !valid_overlay_option(overlay_option)) {
+                std::cerr << "Error: Unknown overlay option '" << overlay_option
+                          << "' (supported: volatile, metacopy=on|off, index=on|off, redirect_dir=on|off|follow|nofollow)\n";
+                return false;
+            }
+        }
+        
+        if (!storage_driver.empty() && storage_driver != "auto" && storage_driver != "overlay" &&
+            storage_driver != "btrfs" && storage_driver != "reflink" && storage_driver != "copy") {
+            std::cerr << "Error: Unknown --storage-driver '" << storage_driver << "' (supported: overlay, btrfs, reflink, copy)\n";
+            return false;
+        }
+        
+        if (rootfs_mode != "cache" && rootfs_mode != "bind") {
+            std::cerr << "Error: Unknown --rootfs-mode '" << rootfs_mode << "' (supported: cache, bind)\n";
+            return false;
+        }
+        
+        if (!cpu_adapt.empty() && cpu_limit.empty()) {
+            std::cerr << "Error: --cpu-adapt needs --cpus as the starting quota\n";
+            return false;
+        }
+        
+        if (!cpuset_mode.empty()) {
+            if (cpuset_mode != "auto") {
+                std::cerr << "Error: Unknown --cpuset mode '" << cpuset_mode << "' (supported: auto)\n";
+                return false;
+            }
+            if (!cpuset_cpus.empty() || !cpuset_mems.empty()) {
+                std::cerr << "Error: --cpuset auto cannot be combined with --cpuset-cpus/--cpuset-mems\n";
+                return false;
+            }
+        }
+        
+        if (rootfs_mode == "bind" && !image_name.empty()) {
+            std::cerr << "Error: --rootfs-mode bind only applies to legacy runs without an image\n";
+            return false;
+        }
+        
         if (command.empty() && !image_name.empty()) {
             // Default command for images
             command.push_back("/bin/sh");
@@ -117,26 +601,141 @@ private:
         return true;
     }
     
+    // Stores the value of whichever of OPTIONS argv[i] is into its target
+    bool parse_value_option(int argc, char* argv[], int& i,
+                            const std::vector<std::pair<std::string, std::string*>>& options) {
+        std::string arg = argv[i];
+        
+        for (const auto& [flag, target] : options) {
+            if (arg == flag && i + 1 < argc) {
+                *target = argv[++i];
+                return true;
+            } else if (arg.starts_with(flag + "=")) {
+                *target = arg.substr(flag.length() + 1);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Accepts both "--flag VALUE" and "--flag=VALUE"; advances i past a consumed value
+    bool parse_resource_option(int argc, char* argv[], int& i) {
+        std::string arg = argv[i];
+        
+        std::vector<std::pair<std::string, std::string*>> options = {
+            {"--memory", &memory_limit},
+            {"--cpus", &cpu_limit},
+            {"--memory-high", &memory_high},
+            {"--memory-low", &memory_low},
+            {"--memory-min", &memory_min},
+            {"--memory-swap", &memory_swap},
+            {"--cpu-weight", &cpu_weight},
+            {"--pids-limit", &pids_limit},
+            {"--pids", &pids_limit},
+            {"--cpuset-cpus", &cpuset_cpus},
+            {"--cpuset-mems", &cpuset_mems},
+            {"--cpuset", &cpuset_mode}
+        };
+        std::vector<std::pair<std::string, std::vector<std::string>*>> list_options = {
+            {"--io-max", &io_max},
+            {"--io", &io_max},
+            {"--io-weight", &io_weight}
+        };
+        
+        return parse_value_option(argc, argv, i, options) || parse_list_option(argc, argv, i, list_options);
+    }
+    
+    // Like parse_value_option, for flags that may be repeated
+    bool parse_list_option(int argc, char* argv[], int& i,
+                           const std::vector<std::pair<std::string, std::vector<std::string>*>>& options) {
+        std::string arg = argv[i];
+        
+        for (const auto& [flag, target] : options) {
+            if (arg == flag && i + 1 < argc) {
+                target->push_back(argv[++i]);
+                return true;
+            } else if (arg.starts_with(flag + "=")) {
+                target->push_back(arg.substr(flag.length() + 1));
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // tmpfs size= syntax: a number with an optional k/m/g suffix, or a percentage of RAM
+    static bool valid_tmpfs_size(const std::string& size) {
+        size_t digits = 0;
+        while (digits < size.size() && std::isdigit(size[digits])) digits++;
+        if (digits == 0) return false;
+        return digits == size.size() ||
+               (digits + 1 == size.size() && std::string("kKmMgG%").find(size.back()) != std::string::npos);
+    }
+    
     bool is_available_image(const std::string& name) {
         // Check if image exists locally
-        std::string images_dir = "/var/lib/iza/images";
+        std::string images_dir = iza_storage_root() + "/images";
         std::string image_dir = images_dir + "/" + name;
-        return std::filesystem::exists(image_dir + "/rootfs");
+        return std::filesystem::exists(image_dir + "/rootfs") || std::filesystem::exists(image_dir + "/layers");
     }
     
     void show_usage() {
         std::cout << "🎯 Iza Container Runtime - Phase 3: Image Management\n\n"
                   << "Usage:\n"
                   << "  iza pull IMAGE                   Download a container image\n"
+                  << "  iza pull --format erofs IMAGE    ... packed into one loop-mounted EROFS/squashfs file\n"
+                  << "  iza pull --format lazy IMAGE     ... indexed only; files are fetched on first open\n"
+                  << "  iza pull --from URL NAME         ... from a .tar.gz rootfs at URL\n"
                   << "  iza images                      List downloaded images\n"
+                  << "  iza topology                    Show host CPU/NUMA topology\n"
+                  << "  iza stats [OPTIONS] [ID]        Stream container resource usage\n"
+                  << "  iza slice [OPTIONS]             Show or set limits shared by all containers\n"
+                  << "  iza prune                       Remove cgroups left behind by dead containers\n"
+                  << "  iza update [--force] ID OPTIONS Change limits of a running container\n"
+                  << "  iza pause ID / iza resume ID    Freeze or thaw a running container\n"
+                  << "  iza pool start NAME N ...       Start N frozen containers, see 'iza pool'\n"
+                  << "  iza pool take NAME              Thaw one warm container and print its ID\n"
+                  << "  iza commit ID NAME[:TAG]        Save a container's changes as a new image layer\n"
+                  << "  iza diff ID                     List paths a container added (A), changed (C) or deleted (D)\n"
                   << "  iza run [OPTIONS] IMAGE [COMMAND] Run container from image\n"
                   << "  iza run [OPTIONS] COMMAND         Run container with custom rootfs\n\n"
                   << "Options:\n"
                   << "  --memory LIMIT    Memory limit (e.g., 100m, 1g)\n"
-                  << "  --cpus LIMIT      CPU limit (e.g., 1, 0.5)\n\n"
+                  << "  --cpus LIMIT      CPU limit (e.g., 1, 0.5)\n"
+                  << "  --memory-high LIMIT  Throttle memory above this instead of OOM killing\n"
+                  << "  --memory-low LIMIT   Best-effort memory protection\n"
+                  << "  --memory-min LIMIT   Hard memory protection\n"
+                  << "  --memory-swap LIMIT  Swap limit (e.g., 0, 200m, max)\n"
+                  << "  --cpu-weight N       Relative CPU weight (1-10000, default 100)\n"
+                  << "  --pids-limit N       Maximum number of processes\n"
+                  << "  --cpuset-cpus LIST   CPUs the container may run on (e.g., 0-3)\n"
+                  << "  --cpuset-mems LIST   NUMA memory nodes (e.g., 0)\n"
+                  << "  --cpuset auto        Pick CPUs and a NUMA node from the host topology\n"
+                  << "  --io-max DEV:LIMITS  I/O limits, repeatable (e.g., /dev/sda:rbps=10m,wiops=100)\n"
+                  << "  --io-weight [DEV:]N  I/O weight, repeatable (e.g., 200, /dev/sda:500)\n"
+                  << "  --pressure-threshold MS  PSI stall time per 2s window to report (default 100)\n"
+                  << "  --on-pressure ACTION     log (default) or relax (raise memory.high by 10%)\n"
+                  << "  --cgroup-parent PATH     Parent cgroup (default iza.slice, or IZA_CGROUP_PARENT)\n"
+                  << "  --rootfs-mode MODE       Legacy rootfs: cache (default) or bind (read-only host dirs)\n"
+                  << "  --storage-driver NAME    overlay, btrfs, reflink or copy (default: by filesystem, or IZA_STORAGE_DRIVER)\n"
+                  << "  --overlay-opts LIST      Overlay options: volatile, metacopy=on, index=off, redirect_dir=on\n"
+                  << "  --read-only              Read-only root filesystem (writable: /tmp, /dev/shm, --tmpfs, -v)\n"
+                  << "  -v HOST:CONTAINER[:ro]   Bind mount a host path, repeatable\n"
+                  << "  --tmpfs PATH[:OPTIONS]   Mount a tmpfs (e.g. /scratch:size=1g,noexec), repeatable\n"
+                  << "  --tmp-size SIZE          Size cap for /tmp (e.g. 512m, 25%; default half of RAM)\n"
+                  << "  --shm-size SIZE          Size of /dev/shm (default 64m)\n"
+                  << "  --tmpfs-huge MODE        Transparent huge pages for /tmp and /dev/shm (e.g. within_size)\n"
+                  << "  --cpu-adapt MAX          Raise the --cpus quota up to MAX cores while throttled\n"
+                  << "  --cpu-burst-max CORES    Upper bound for cpu.max.burst (default: the --cpus value)\n"
+                  << "  --cpu-period-range MIN:MAX  CFS period bounds in us (default 10000:100000)\n"
+                  << "  --reclaim-idle STEP      Shrink idle containers by STEP (e.g. 16m, 10%) via memory.reclaim\n"
+                  << "  --reclaim-interval SEC   Idle seconds between reclaim steps (default 10)\n"
+                  << "  --idle-threshold PCT     Idle below this CPU use, percent of one core (default 2)\n"
+                  << "  --ready-file PATH        (pool) File the entrypoint creates once it is ready\n\n"
                   << "Examples:\n"
                   << "  iza pull ubuntu:latest\n"
                   << "  iza images\n"
+                  << "  iza stats --interval 2 --format json\n"
+                  << "  iza stats --perf --no-stream\n"
                   << "  iza run ubuntu:latest\n"
                   << "  iza run ubuntu:latest /bin/bash\n"
                   << "  iza run --memory 100m ubuntu:latest python3\n"
@@ -144,6 +743,110 @@ private:
     }
 };
 
+// SHA-256 (FIPS 180-4), for content-addressing rootfs trees and layers
+class Sha256 {
+private:
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char block[64];
+    size_t block_len = 0;
+    uint64_t total_len = 0;
+    
+    static constexpr uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    
+    static uint32_t rotr(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+    
+    void compress(const unsigned char* p) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+    
+public:
+    void update(const void* data, size_t len) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        total_len += len;
+        
+        if (block_len > 0) {
+            size_t take = std::min(len, sizeof(block) - block_len);
+            memcpy(block + block_len, p, take);
+            block_len += take;
+            p += take;
+            len -= take;
+            if (block_len < sizeof(block)) return;
+            compress(block);
+            block_len = 0;
+        }
+        for (; len >= 64; p += 64, len -= 64) {
+            compress(p);
+        }
+        memcpy(block, p, len);
+        block_len = len;
+    }
+    
+    void update(const std::string& data) {
+        update(data.data(), data.size());
+    }
+    
+    // Finishes the hash; the object must not be updated afterwards
+    std::string hex_digest() {
+        uint64_t bits = total_len * 8;
+        unsigned char pad[72] = {0x80};
+        size_t pad_len = (block_len < 56 ? 56 : 120) - block_len;
+        for (int i = 0; i < 8; i++) {
+            pad[pad_len + i] = (unsigned char)(bits >> (56 - 8 * i));
+        }
+        update(pad, pad_len + 8);
+        
+        char hex[65];
+        for (int i = 0; i < 8; i++) {
+            snprintf(hex + i * 8, 9, "%08x", state[i]);
+        }
+        return std::string(hex, 64);
+    }
+    
+    // Feeds a whole file; returns -1 if it can't be read
+    int update_file(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return -1;
+        
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            update(buf, n);
+        }
+        close(fd);
+        return n < 0 ? -1 : 0;
+    }
+};
+
 // Callback function for writing downloaded data
 struct DownloadData {
     std::string data;
@@ -155,580 +858,6675 @@ static size_t WriteCallback(void *contents, size_t size, size_t nmemb, DownloadD
     return realsize;
 }
 
-class ImageManager {
-private:
-    std::string images_dir = "/var/lib/iza/images";
-    std::string cache_dir = "/var/lib/iza/cache";
-    
+// Table of contents of a gzipped image tarball, for lazy pulls: each
+// entry's metadata and the offset of its data in the uncompressed tar, plus
+// zran-style checkpoints (the deflate bit position and the 32KB window
+// before it) every SPAN bytes, so any file can be inflated from an HTTP
+// range starting near it instead of from the top of the tarball
+class LazyIndex {
 public:
-    ImageManager() {
-        // Ensure directories exist
-        std::filesystem::create_directories(images_dir);
-        std::filesystem::create_directories(cache_dir);
-    }
+    struct Entry {
+        std::string path;       // Relative, without "./" or a trailing "/"; "" is the root
+        char type = '0';        // Tar typeflag: 0 file, 1 hard link, 2 symlink, 3/4 device, 5 dir, 6 fifo
+        uint32_t mode = 0, uid = 0, gid = 0, dev_major = 0, dev_minor = 0;
+        uint64_t mtime = 0, size = 0;
+        uint64_t offset = 0;    // Of the data in the uncompressed tar
+        std::string link;       // Symlink target or hard link source
+    };
+    struct Checkpoint {
+        uint64_t in = 0;        // Compressed offset of the first whole byte
+        uint64_t out = 0;       // Uncompressed offset
+        int bits = 0;           // Bits of the byte before IN still to inflate
+        std::string window;     // Up to 32KB of output before OUT
+    };
     
-    int pull_image(const std::string& image_name) {
-        std::cout << "[IMAGE] Pulling image: " << image_name << std::endl;
-        
-        // Parse image name (simple format: name:tag)
-        std::string name, tag;
-        size_t colon_pos = image_name.find(':');
-        if (colon_pos != std::string::npos) {
-            name = image_name.substr(0, colon_pos);
-            tag = image_name.substr(colon_pos + 1);
-        } else {
-            name = image_name;
-            tag = "latest";
-        }
-        
-        // For now, we'll download a pre-built minimal rootfs
-        // In a real implementation, this would query Docker Hub API
-        std::string download_url;
-        if (name == "ubuntu") {
-            // Use a pre-built minimal Ubuntu rootfs
-            download_url = "https://github.com/ianmackinnon/ubuntu-minimal-rootfs/releases/download/20.04/ubuntu-minimal-rootfs-20.04.tar.gz";
-        } else if (name == "alpine") {
-            // Use Alpine Linux minirootfs
-            download_url = "https://dl-cdn.alpinelinux.org/alpine/v3.18/releases/x86_64/alpine-minirootfs-3.18.4-x86_64.tar.gz";
-        } else {
-            std::cerr << "Error: Unsupported image '" << name << "'. Supported: ubuntu, alpine" << std::endl;
+    // What a range response must match to come from the indexed tarball
+    struct Validator {
+        uint64_t size = 0;
+        std::string etag, last_modified;    // Empty if the server sent none
+    };
+    
+    static constexpr uint64_t SPAN = 1 << 20;
+    static constexpr size_t WINDOW = 32768;
+    
+    std::vector<Entry> entries;
+    std::vector<Checkpoint> checkpoints;
+    uint64_t blob_size = 0;     // Compressed size
+    std::string blob_digest;    // sha256 of the tarball; binds a published index to it
+    
+    // Streams URL once, indexing it without storing or extracting any data
+    int build(const std::string& url) {
+        entries.clear();
+        checkpoints.clear();
+        blob_size = 0;
+        blob_hash = Sha256();
+        memset(&strm, 0, sizeof(strm));
+        if (inflateInit2(&strm, 47) != Z_OK) {  // 47: gzip or zlib header, 32KB window
+            std::cerr << "Failed to initialize zlib" << std::endl;
             return -1;
         }
+        window.assign(WINDOW, '\0');
+        strm.avail_out = 0;
+        total_in = total_out = 0;
+        failed = stream_done = tar_done = false;
+        header.clear();
         
-        // Download the image
-        std::string image_path = cache_dir + "/" + image_name + ".tar.gz";
-        if (download_file(download_url, image_path) != 0) {
-            std::cerr << "Failed to download image" << std::endl;
-            return -1;
+        int result = http_get(url, "", [this](const char* data, size_t len) {
+            return feed(reinterpret_cast<const unsigned char*>(data), len) == 0;
+        });
+        if (result == 0 && !failed) {
+            finish();
         }
-        
-        // Extract the image
-        std::string extract_dir = images_dir + "/" + image_name;
-        if (extract_image(image_path, extract_dir) != 0) {
-            std::cerr << "Failed to extract image" << std::endl;
+        inflateEnd(&strm);
+        if (result != 0 || failed || !stream_done || !tar_done) {
+            std::cerr << "Failed to index " << url << (result == 0 && !failed ? ": truncated archive" : "") << std::endl;
             return -1;
         }
-        
-        std::cout << "[IMAGE] Successfully pulled " << image_name << std::endl;
+        blob_digest = blob_hash.hex_digest();
         return 0;
     }
     
-    int list_images() {
-        std::cout << "REPOSITORY          TAG       SIZE\n";
-        std::cout << "==========================================\n";
+    // Calls SINK with the uncompressed tar from checkpoint CP on, fetched
+    // as one open-ended HTTP range of the tarball EXPECT describes, until
+    // SINK returns false
+    static int inflate_from(const std::string& url, const Checkpoint& cp, const Validator& expect,
+                            const std::function<bool(uint64_t, const unsigned char*, size_t)>& sink) {
+        z_stream z = {};
+        if (inflateInit2(&z, -15) != Z_OK) return -1;  // Raw deflate: no header mid-stream
         
-        if (!std::filesystem::exists(images_dir)) {
-            std::cout << "(no images found)\n";
-            return 0;
+        bool primed = cp.bits == 0;
+        bool done = false;
+        uint64_t pos = cp.out;
+        unsigned char out[65536];
+        uint64_t start = cp.in - (cp.bits ? 1 : 0);
+        if (primed && !cp.window.empty()) {
+            inflateSetDictionary(&z, reinterpret_cast<const Bytef*>(cp.window.data()), cp.window.size());
         }
         
-        for (const auto& entry : std::filesystem::directory_iterator(images_dir)) {
-            if (entry.is_directory()) {
-                std::string image_name = entry.path().filename().string();
-                std::string rootfs_path = entry.path() / "rootfs";
+        int result = http_get(url, std::to_string(start) + "-", [&](const char* data, size_t len) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+            if (!primed) {
+                // The checkpoint starts inside this byte
+                inflatePrime(&z, cp.bits, p[0] >> (8 - cp.bits));
+                if (!cp.window.empty()) {
+                    inflateSetDictionary(&z, reinterpret_cast<const Bytef*>(cp.window.data()), cp.window.size());
+                }
+                primed = true;
+                p++;
+                len--;
+            }
+            z.next_in = const_cast<Bytef*>(p);
+            z.avail_in = len;
+            // A full output buffer may leave more output pending
+            do {
+                z.next_out = out;
+                z.avail_out = sizeof(out);
+                int ret = inflate(&z, Z_NO_FLUSH);
+                if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) return false;
+                size_t produced = sizeof(out) - z.avail_out;
+                if (produced > 0 && !sink(pos, out, produced)) done = true;
+                pos += produced;
+                if (ret == Z_STREAM_END) done = true;
+                if (ret == Z_BUF_ERROR) break;
+            } while ((z.avail_in > 0 || z.avail_out == 0) && !done);
+            return !done;
+        }, false, &expect);
+        inflateEnd(&z);
+        return done && result == 0 ? 0 : -1;
+    }
+    
+    // Fetches URL (or RANGE of it) into CALLBACK, which returns false to
+    // stop early; that is not an error. Returns 1 if the server ignored RANGE.
+    // With EXPECT, a range of a tarball of another size or validator fails.
+    static int http_get(const std::string& url, const std::string& range,
+                        const std::function<bool(const char*, size_t)>& callback, bool quiet = false,
+                        const Validator* expect = nullptr) {
+        struct Transfer {
+            const std::function<bool(const char*, size_t)>* callback;
+            CURL* curl;
+            bool ranged;
+            const Validator* expect;
+            Validator seen;
+            bool checked = false;
+            bool stopped = false;
+            bool unranged = false;
+            bool changed = false;
+        } transfer = {&callback, curl_easy_init(), !range.empty(), expect, {}};
+        if (!transfer.curl) {
+            std::cerr << "Failed to initialize curl" << std::endl;
+            return -1;
+        }
+        
+        auto header = +[](char* data, size_t size, size_t nmemb, Transfer* t) -> size_t {
+            read_header(std::string(data, size * nmemb), t->seen);
+            return size * nmemb;
+        };
+        auto write = +[](char* data, size_t size, size_t nmemb, Transfer* t) -> size_t {
+            long code = 0;
+            curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &code);
+            if (t->ranged && code != 206) {
+                t->unranged = true;
+                return 0;
+            }
+            if (t->expect != nullptr && !t->checked) {
+                t->checked = true;
+                const Validator& want = *t->expect;
+                if (t->seen.size != want.size ||
+                    (!want.etag.empty() && !t->seen.etag.empty() && t->seen.etag != want.etag) ||
+                    (!want.last_modified.empty() && !t->seen.last_modified.empty() &&
+                     t->seen.last_modified != want.last_modified)) {
+                    t->changed = true;
+                    return 0;
+                }
+            }
+            if (!(*t->callback)(data, size * nmemb)) {
+                t->stopped = true;
+                return 0;
+            }
+            return size * nmemb;
+        };
+        curl_easy_setopt(transfer.curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(transfer.curl, CURLOPT_WRITEFUNCTION, write);
+        curl_easy_setopt(transfer.curl, CURLOPT_WRITEDATA, &transfer);
+        curl_easy_setopt(transfer.curl, CURLOPT_HEADERFUNCTION, header);
+        curl_easy_setopt(transfer.curl, CURLOPT_HEADERDATA, &transfer);
+        curl_easy_setopt(transfer.curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(transfer.curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(transfer.curl, CURLOPT_USERAGENT, "iza-container-runtime/1.0");
+        if (!range.empty()) {
+            curl_easy_setopt(transfer.curl, CURLOPT_RANGE, range.c_str());
+        }
+        
+        CURLcode res = curl_easy_perform(transfer.curl);
+        curl_easy_cleanup(transfer.curl);
+        if (transfer.unranged) {
+            if (!quiet) std::cerr << "[LAZY] " << url << " was not served as a byte range" << std::endl;
+            return 1;
+        }
+        if (transfer.changed) {
+            std::cerr << "[LAZY] " << url << " is no longer the tarball that was indexed; pull it again" << std::endl;
+            return -1;
+        }
+        if (res != CURLE_OK && !transfer.stopped) {
+            if (!quiet) std::cerr << "[LAZY] Fetching " << url << ": " << curl_easy_strerror(res) << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    
+    // Compressed size of URL from a HEAD request, or -1. VALIDATOR gets the
+    // ETag and Last-Modified headers, if any.
+    static long long remote_size(const std::string& url, Validator* validator = nullptr) {
+        CURL* curl = curl_easy_init();
+        if (!curl) return -1;
+        Validator seen;
+        auto header = +[](char* data, size_t size, size_t nmemb, Validator* v) -> size_t {
+            read_header(std::string(data, size * nmemb), *v);
+            return size * nmemb;
+        };
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &seen);
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "iza-container-runtime/1.0");
+        curl_off_t size = -1;
+        if (curl_easy_perform(curl) == CURLE_OK) {
+            curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size);
+        }
+        curl_easy_cleanup(curl);
+        if (validator != nullptr) {
+            *validator = seen;
+            validator->size = size > 0 ? size : 0;
+        }
+        return size;
+    }
+    
+    int save(const std::string& path) const {
+        std::string data = serialize();
+        std::string tmp = path + ".tmp";
+        std::ofstream out(tmp, std::ios::binary);
+        out.write(data.data(), data.size());
+        out.close();
+        if (out.fail() || rename(tmp.c_str(), path.c_str()) != 0) {
+            perror(("Failed to save " + path).c_str());
+            std::filesystem::remove(tmp);
+            return -1;
+        }
+        return 0;
+    }
+    
+    int load(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (!in.good() && !in.eof()) return -1;
+        return parse(data);
+    }
+    
+    std::string serialize() const {
+        std::string out = MAGIC;
+        put(out, blob_size);
+        put(out, blob_digest);
+        put(out, entries.size());
+        for (const auto& e : entries) {
+            put(out, e.path);
+            out += e.type;
+            for (uint64_t value : {(uint64_t)e.mode, (uint64_t)e.uid, (uint64_t)e.gid, (uint64_t)e.dev_major,
+                                   (uint64_t)e.dev_minor, e.mtime, e.size, e.offset}) {
+                put(out, value);
+            }
+            put(out, e.link);
+        }
+        put(out, checkpoints.size());
+        for (const auto& cp : checkpoints) {
+            put(out, cp.in);
+            put(out, cp.out);
+            put(out, (uint64_t)cp.bits);
+            put(out, cp.window);
+        }
+        return out;
+    }
+    
+    // Returns -1 unless DATA is a complete index
+    int parse(const std::string& data) {
+        size_t pos = strlen(MAGIC);
+        if (data.compare(0, pos, MAGIC) != 0) return -1;
+        
+        uint64_t count;
+        if (!get(data, pos, blob_size) || !get(data, pos, blob_digest) || blob_digest.size() != 64 ||
+            !get(data, pos, count) || count > data.size()) return -1;
+        entries.assign(count, Entry());
+        for (auto& e : entries) {
+            uint64_t mode, uid, gid, major, minor;
+            if (!get(data, pos, e.path) || pos >= data.size()) return -1;
+            e.type = data[pos++];
+            if (!get(data, pos, mode) || !get(data, pos, uid) || !get(data, pos, gid) ||
+                !get(data, pos, major) || !get(data, pos, minor) || !get(data, pos, e.mtime) ||
+                !get(data, pos, e.size) || !get(data, pos, e.offset) || !get(data, pos, e.link)) return -1;
+            // Published indexes come from the network: only what build() emits
+            if (!strchr("0123456", e.type) || e.type == '\0' || !valid_path(e.path) ||
+                (e.type == '1' && (e.link.empty() || !valid_path(e.link)))) return -1;
+            e.mode = mode; e.uid = uid; e.gid = gid; e.dev_major = major; e.dev_minor = minor;
+        }
+        if (!get(data, pos, count) || count > data.size()) return -1;
+        checkpoints.assign(count, Checkpoint());
+        for (size_t i = 0; i < checkpoints.size(); i++) {
+            auto& cp = checkpoints[i];
+            uint64_t bits;
+            if (!get(data, pos, cp.in) || !get(data, pos, cp.out) || !get(data, pos, bits) ||
+                !get(data, pos, cp.window) || bits > 7 || cp.window.size() > WINDOW) return -1;
+            // checkpoint_before() needs one at 0 and a sorted list
+            if (i == 0 ? cp.out != 0 : cp.out <= checkpoints[i - 1].out || cp.in <= checkpoints[i - 1].in) return -1;
+            cp.bits = bits;
+        }
+        return pos == data.size() && !checkpoints.empty() ? 0 : -1;
+    }
+    
+    // Last checkpoint at or before uncompressed OFFSET
+    const Checkpoint& checkpoint_before(uint64_t offset) const {
+        auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), offset,
+                                   [](uint64_t off, const Checkpoint& cp) { return off < cp.out; });
+        return *std::prev(it);
+    }
+    
+private:
+    static constexpr const char* MAGIC = "IZALAZY2";
+    
+    // Inflate state while building
+    z_stream strm = {};
+    Sha256 blob_hash;
+    std::string window;
+    uint64_t total_in = 0, total_out = 0;
+    bool failed = false, stream_done = false;
+    
+    // Tar parser state while building
+    std::string header;
+    uint64_t data_left = 0, pad_left = 0;
+    char meta_type = 0;         // Collecting a pax ('x') or GNU long name ('L', 'K') record
+    std::string meta;
+    std::string long_path, long_link, pax_path, pax_link;
+    long long pax_size = -1, pax_uid = -1, pax_gid = -1, pax_mtime = -1;
+    bool tar_done = false;
+    
+    // Picks the total size out of Content-Range and the ETag and
+    // Last-Modified validators; a status line starts a new response
+    static void read_header(const std::string& line, Validator& v) {
+        size_t colon = line.find(':');
+        if (line.starts_with("HTTP/")) {
+            v = Validator();
+            return;
+        }
+        if (colon == std::string::npos) return;
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        size_t start = line.find_first_not_of(" \t", colon + 1);
+        size_t end = line.find_last_not_of(" \t\r\n");
+        std::string value = start == std::string::npos || end < start ? "" : line.substr(start, end - start + 1);
+        if (name == "content-range") {
+            size_t slash = value.rfind('/');
+            if (slash != std::string::npos) v.size = strtoull(value.c_str() + slash + 1, nullptr, 10);
+        } else if (name == "etag") {
+            v.etag = value;
+        } else if (name == "last-modified") {
+            v.last_modified = value;
+        }
+    }
+    
+    static void put(std::string& out, uint64_t value) {
+        for (int i = 0; i < 8; i++) out += (char)(value >> (8 * i));
+    }
+    
+    static void put(std::string& out, const std::string& value) {
+        put(out, (uint64_t)value.size());
+        out += value;
+    }
+    
+    static bool get(const std::string& data, size_t& pos, uint64_t& value) {
+        if (data.size() - pos < 8) return false;
+        value = 0;
+        for (int i = 0; i < 8; i++) value |= (uint64_t)(unsigned char)data[pos + i] << (8 * i);
+        pos += 8;
+        return true;
+    }
+    
+    // Relative, with no empty, "." or ".." components; "" is the root
+    static bool valid_path(const std::string& path) {
+        if (path.empty()) return true;
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) end = path.size();
+            std::string part = path.substr(start, end - start);
+            if (part.empty() || part == "." || part == "..") return false;
+            start = end + 1;
+        }
+        return true;
+    }
+    
+    static bool get(const std::string& data, size_t& pos, std::string& value) {
+        uint64_t len;
+        if (!get(data, pos, len) || data.size() - pos < len) return false;
+        value = data.substr(pos, len);
+        pos += len;
+        return true;
+    }
+    
+    int feed(const unsigned char* data, size_t len) {
+        blob_size += len;
+        blob_hash.update(data, len);
+        if (stream_done) return 0;  // gzip trailer or trailing members
+        
+        strm.next_in = const_cast<Bytef*>(data);
+        strm.avail_in = len;
+        while (strm.avail_in > 0 && !stream_done) {
+            if (inflate_step() != 0) return -1;
+        }
+        return 0;
+    }
+    
+    // Drains output inflate still holds after the last input
+    void finish() {
+        while (!stream_done && !failed) {
+            uint64_t before = total_out;
+            if (inflate_step() != 0 || (total_out == before && !stream_done)) break;
+        }
+    }
+    
+    int inflate_step() {
+        if (strm.avail_out == 0) {
+            strm.next_out = reinterpret_cast<Bytef*>(&window[0]);
+            strm.avail_out = WINDOW;
+        }
+        unsigned char* start = strm.next_out;
+        uInt in_before = strm.avail_in;
+        
+        // Z_BLOCK stops at each deflate block boundary, where a checkpoint can go
+        int ret = inflate(&strm, Z_BLOCK);
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+            std::cerr << "[LAZY] Corrupt gzip stream: " << (strm.msg ? strm.msg : "inflate failed") << std::endl;
+            failed = true;
+            return -1;
+        }
+        total_in += in_before - strm.avail_in;
+        size_t produced = strm.next_out - start;
+        total_out += produced;
+        parse_tar(start, produced);
+        
+        if (ret == Z_STREAM_END) {
+            stream_done = true;
+        } else if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                   (checkpoints.empty() || total_out - checkpoints.back().out >= SPAN)) {
+            add_checkpoint();
+        }
+        return 0;
+    }
+    
+    void add_checkpoint() {
+        Checkpoint cp;
+        cp.in = total_in;
+        cp.out = total_out;
+        cp.bits = strm.data_type & 7;
+        
+        // The window is a ring; its oldest bytes start at the write position
+        size_t left = strm.avail_out;
+        std::string ring = window.substr(WINDOW - left) + window.substr(0, WINDOW - left);
+        cp.window = ring.substr(WINDOW - std::min<uint64_t>(total_out, WINDOW));
+        checkpoints.push_back(std::move(cp));
+    }
+    
+    void parse_tar(const unsigned char* p, size_t n) {
+        while (n > 0 && !tar_done) {
+            size_t take;
+            if (data_left > 0) {
+                take = std::min<uint64_t>(data_left, n);
+                if (meta_type) meta.append(reinterpret_cast<const char*>(p), take);
+                data_left -= take;
+                if (data_left == 0 && meta_type) finish_meta();
+            } else if (pad_left > 0) {
+                take = std::min<uint64_t>(pad_left, n);
+                pad_left -= take;
+            } else {
+                take = std::min(512 - header.size(), n);
+                header.append(reinterpret_cast<const char*>(p), take);
+                if (header.size() == 512) {
+                    parse_header(total_out - n + take);
+                    header.clear();
+                }
+            }
+            p += take;
+            n -= take;
+        }
+    }
+    
+    static uint64_t tar_number(const char* field, size_t len) {
+        uint64_t value = 0;
+        if ((unsigned char)field[0] & 0x80) {
+            // base-256, for values too big for octal
+            value = field[0] & 0x7f;
+            for (size_t i = 1; i < len; i++) value = value << 8 | (unsigned char)field[i];
+            return value;
+        }
+        size_t i = 0;
+        while (i < len && field[i] == ' ') i++;
+        for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) value = value * 8 + (field[i] - '0');
+        return value;
+    }
+    
+    static std::string tar_string(const char* field, size_t len) {
+        return std::string(field, strnlen(field, len));
+    }
+    
+    static std::string normalize(std::string path) {
+        while (path.starts_with("./")) path.erase(0, 2);
+        while (path.starts_with("/")) path.erase(0, 1);
+        while (path.ends_with("/")) path.pop_back();
+        return path == "." ? "" : path;
+    }
+    
+    // DATA_OFFSET: where the entry's data starts in the uncompressed tar
+    void parse_header(uint64_t data_offset) {
+        const char* h = header.data();
+        if (std::all_of(header.begin(), header.end(), [](char c) { return c == 0; })) {
+            tar_done = true;  // End-of-archive block
+            return;
+        }
+        
+        char type = h[156];
+        uint64_t size = pax_size >= 0 ? pax_size : tar_number(h + 124, 12);
+        data_left = size;
+        pad_left = (512 - size % 512) % 512;
+        if (type == 'x' || type == 'L' || type == 'K') {
+            meta_type = type;
+            meta.clear();
+            if (size == 0) finish_meta();
+            return;
+        }
+        if (type == 'g') return;  // Global pax header: nothing iza serves
+        
+        Entry e;
+        std::string name = tar_string(h, 100);
+        std::string prefix = memcmp(h + 257, "ustar", 5) == 0 ? tar_string(h + 345, 155) : "";
+        e.path = normalize(!pax_path.empty() ? pax_path : !long_path.empty() ? long_path
+                           : prefix.empty() ? name : prefix + "/" + name);
+        e.link = !pax_link.empty() ? pax_link : !long_link.empty() ? long_link : tar_string(h + 157, 100);
+        e.type = type == '\0' || type == '7' ? '0' : type;
+        e.mode = tar_number(h + 100, 8) & 07777;
+        e.uid = pax_uid >= 0 ? pax_uid : tar_number(h + 108, 8);
+        e.gid = pax_gid >= 0 ? pax_gid : tar_number(h + 116, 8);
+        e.mtime = pax_mtime >= 0 ? pax_mtime : tar_number(h + 136, 12);
+        e.dev_major = tar_number(h + 329, 8);
+        e.dev_minor = tar_number(h + 337, 8);
+        e.size = e.type == '0' ? size : 0;
+        e.offset = data_offset;
+        if (e.type == '1') e.link = normalize(e.link);
+        
+        long_path.clear();
+        long_link.clear();
+        pax_path.clear();
+        pax_link.clear();
+        pax_size = pax_uid = pax_gid = pax_mtime = -1;
+        
+        // A base image has nothing below it to white out, and names that
+        // would climb out of the image are not served at all
+        std::string base = e.path.substr(e.path.rfind('/') + 1);
+        if (!base.starts_with(".wh.") && strchr("0123456", e.type) && valid_path(e.path) &&
+            (e.type != '1' || valid_path(e.link))) {
+            entries.push_back(std::move(e));
+        }
+    }
+    
+    void finish_meta() {
+        if (meta_type == 'L') {
+            long_path = meta.substr(0, strnlen(meta.c_str(), meta.size()));
+        } else if (meta_type == 'K') {
+            long_link = meta.substr(0, strnlen(meta.c_str(), meta.size()));
+        } else {
+            // Records are "LENGTH KEY=VALUE\n"
+            size_t pos = 0;
+            while (pos < meta.size()) {
+                size_t space = meta.find(' ', pos);
+                if (space == std::string::npos) break;
+                size_t len = strtoull(meta.c_str() + pos, nullptr, 10);
+                if (len == 0 || pos + len > meta.size()) break;
+                std::string record = meta.substr(space + 1, pos + len - space - 2);
+                size_t eq = record.find('=');
+                std::string key = record.substr(0, eq), value = eq == std::string::npos ? "" : record.substr(eq + 1);
+                if (key == "path") pax_path = value;
+                else if (key == "linkpath") pax_link = value;
+                else if (key == "size") pax_size = strtoll(value.c_str(), nullptr, 10);
+                else if (key == "uid") pax_uid = strtoll(value.c_str(), nullptr, 10);
+                else if (key == "gid") pax_gid = strtoll(value.c_str(), nullptr, 10);
+                else if (key == "mtime") pax_mtime = strtoll(value.c_str(), nullptr, 10);
+                pos += len;
+            }
+        }
+        meta_type = 0;
+        meta.clear();
+    }
+};
+
+// Serves a lazily pulled image over /dev/fuse from its LazyIndex. File
+// data is fetched on first open, as one HTTP range from the checkpoint
+// before it; every other file that range passes through is cached on the
+// way. First opens are appended to the image's hot set, which the next
+// mount prefetches in the background.
+class LazyImageServer {
+private:
+    struct Node {
+        size_t entry = SIZE_MAX;    // Index in the index; SIZE_MAX for an implied directory
+        std::string path;
+        std::vector<std::pair<std::string, uint64_t>> children;
+        uint32_t nlink = 1;
+    };
+    
+    static constexpr uint64_t TIMEOUT = 86400;  // The image never changes under a mount
+    static constexpr size_t WORKERS = 4;
+    
+    std::string image_dir;
+    std::string cache_dir;
+    std::string url;
+    LazyIndex index;
+    LazyIndex::Validator remote;                    // The tarball URL must still be
+    std::vector<Node> nodes;                        // Node IDs index this; 1 is the root
+    std::unordered_map<std::string, uint64_t> by_path;
+    std::vector<size_t> by_offset;                  // Regular files with data, in tar order
+    
+    std::mutex lock;
+    std::condition_variable fetched;
+    std::vector<char> state;                        // Per entry: 0 remote, 1 fetching, 2 cached
+    std::set<std::string> hot;
+    int fuse_fd = -1;
+    
+public:
+    explicit LazyImageServer(const std::string& dir)
+        : image_dir(dir), cache_dir(dir + "/cache") {}
+    
+    int load() {
+        std::ifstream source(image_dir + "/source");
+        std::getline(source, url);
+        if (url.empty() || index.load(image_dir + "/index") != 0) {
+            std::cerr << "Error: " << image_dir << " has no valid lazy index; pull it again" << std::endl;
+            return -1;
+        }
+        remote.size = index.blob_size;
+        std::ifstream validator(image_dir + "/validator");
+        for (std::string line; std::getline(validator, line);) {
+            if (line.starts_with("etag=")) remote.etag = line.substr(5);
+            else if (line.starts_with("last-modified=")) remote.last_modified = line.substr(14);
+        }
+        std::filesystem::create_directories(cache_dir);
+        
+        nodes.resize(2);
+        nodes[1].nlink = 2;
+        by_path[""] = 1;
+        for (size_t i = 0; i < index.entries.size(); i++) {
+            add_entry(i);
+        }
+        for (auto& node : nodes) {
+            for (const auto& child : node.children) {
+                if (is_dir(child.second)) node.nlink++;
+            }
+        }
+        
+        state.assign(index.entries.size(), 0);
+        for (size_t i = 0; i < index.entries.size(); i++) {
+            const auto& e = index.entries[i];
+            if (e.type != '0') continue;
+            if (e.size > 0) by_offset.push_back(i);
+            if (access(cache_path(i).c_str(), F_OK) == 0) state[i] = 2;
+        }
+        std::sort(by_offset.begin(), by_offset.end(), [this](size_t a, size_t b) {
+            return index.entries[a].offset < index.entries[b].offset;
+        });
+        
+        std::ifstream hot_file(image_dir + "/hotset");
+        std::string line;
+        while (std::getline(hot_file, line)) hot.insert(line);
+        return 0;
+    }
+    
+    // Handles requests on FD until the filesystem is unmounted
+    void serve(int fd) {
+        fuse_fd = fd;
+        std::thread(&LazyImageServer::prefetch, this).detach();
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < WORKERS; i++) {
+            workers.emplace_back(&LazyImageServer::serve_requests, this);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    
+private:
+    std::string cache_path(size_t entry) const {
+        return cache_dir + "/" + std::to_string(entry);
+    }
+    
+    bool is_dir(uint64_t node) const {
+        size_t e = nodes[node].entry;
+        return e == SIZE_MAX || index.entries[e].type == '5';
+    }
+    
+    uint64_t ensure_dir(const std::string& path) {
+        auto it = by_path.find(path);
+        if (it != by_path.end()) return it->second;
+        
+        size_t slash = path.rfind('/');
+        uint64_t parent = ensure_dir(slash == std::string::npos ? "" : path.substr(0, slash));
+        uint64_t id = nodes.size();
+        nodes.emplace_back();
+        nodes[id].path = path;
+        nodes[id].nlink = 2;
+        nodes[parent].children.emplace_back(path.substr(slash + 1), id);
+        by_path[path] = id;
+        return id;
+    }
+    
+    void add_entry(size_t i) {
+        const auto& e = index.entries[i];
+        if (e.path.empty()) {
+            nodes[1].entry = i;
+            return;
+        }
+        
+        auto existing = by_path.find(e.path);
+        if (e.type == '1') {
+            // A hard link is another name for its source's node
+            auto source = by_path.find(e.link);
+            if (source == by_path.end() || existing != by_path.end()) return;
+            size_t slash = e.path.rfind('/');
+            uint64_t parent = ensure_dir(slash == std::string::npos ? "" : e.path.substr(0, slash));
+            nodes[parent].children.emplace_back(e.path.substr(slash + 1), source->second);
+            nodes[source->second].nlink++;
+            by_path[e.path] = source->second;
+            return;
+        }
+        if (existing != by_path.end()) {
+            // Later entries replace earlier ones, as tar extraction would
+            nodes[existing->second].entry = i;
+            return;
+        }
+        if (e.type == '5') {
+            nodes[ensure_dir(e.path)].entry = i;
+            return;
+        }
+        
+        size_t slash = e.path.rfind('/');
+        uint64_t parent = ensure_dir(slash == std::string::npos ? "" : e.path.substr(0, slash));
+        uint64_t id = nodes.size();
+        nodes.emplace_back();
+        nodes[id].entry = i;
+        nodes[id].path = e.path;
+        nodes[parent].children.emplace_back(e.path.substr(slash + 1), id);
+        by_path[e.path] = id;
+    }
+    
+    void fill_attr(uint64_t id, struct fuse_attr& attr) const {
+        const Node& node = nodes[id];
+        memset(&attr, 0, sizeof(attr));
+        attr.ino = id;
+        attr.nlink = node.nlink;
+        attr.blksize = 4096;
+        if (node.entry == SIZE_MAX) {
+            attr.mode = S_IFDIR | 0755;
+            attr.size = 4096;
+            return;
+        }
+        
+        const auto& e = index.entries[node.entry];
+        static const std::map<char, uint32_t> types = {
+            {'0', S_IFREG}, {'2', S_IFLNK}, {'3', S_IFCHR}, {'4', S_IFBLK}, {'5', S_IFDIR}, {'6', S_IFIFO}};
+        attr.mode = types.at(e.type) | e.mode;
+        attr.size = e.type == '0' ? e.size : e.type == '2' ? e.link.size() : e.type == '5' ? 4096 : 0;
+        attr.blocks = (attr.size + 511) / 512;
+        attr.uid = e.uid;
+        attr.gid = e.gid;
+        attr.atime = attr.mtime = attr.ctime = e.mtime;
+        // The kernel's new_encode_dev() layout
+        attr.rdev = (e.dev_minor & 0xff) | (e.dev_major << 8) | ((e.dev_minor & ~0xffu) << 12);
+    }
+    
+    void reply(uint64_t unique, int error, const void* data = nullptr, size_t len = 0) {
+        struct fuse_out_header out = {};
+        out.len = sizeof(out) + (error ? 0 : len);
+        out.error = -error;
+        out.unique = unique;
+        struct iovec iov[2] = {{&out, sizeof(out)}, {const_cast<void*>(data), error ? 0 : len}};
+        // ENOENT: the request was interrupted and no longer wants an answer
+        if (writev(fuse_fd, iov, 2) < 0 && errno != ENOENT) {
+            perror("[LAZY] Failed to reply");
+        }
+    }
+    
+    void serve_requests() {
+        // Requests carry at most max_write bytes of payload
+        std::vector<char> buf(FUSE_MIN_READ_BUFFER + 131072);
+        for (;;) {
+            ssize_t n = read(fuse_fd, buf.data(), buf.size());
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == ENOENT) continue;
+                if (errno != ENODEV) perror("[LAZY] Failed to read /dev/fuse");
+                return;  // ENODEV: unmounted
+            }
+            if ((size_t)n < sizeof(struct fuse_in_header)) continue;
+            
+            const auto* in = reinterpret_cast<const struct fuse_in_header*>(buf.data());
+            const char* arg = buf.data() + sizeof(*in);
+            if (in->opcode == FUSE_DESTROY) {
+                reply(in->unique, 0);
+                return;
+            }
+            handle(*in, arg);
+        }
+    }
+    
+    void handle(const struct fuse_in_header& in, const char* arg) {
+        uint64_t id = in.nodeid;
+        if (in.opcode != FUSE_INIT && (id == 0 || id >= nodes.size())) {
+            if (in.opcode != FUSE_FORGET && in.opcode != FUSE_BATCH_FORGET && in.opcode != FUSE_INTERRUPT) {
+                reply(in.unique, ESTALE);
+            }
+            return;
+        }
+        
+        switch (in.opcode) {
+        case FUSE_INIT: {
+            const auto* init = reinterpret_cast<const struct fuse_init_in*>(arg);
+            struct fuse_init_out out = {};
+            out.major = FUSE_KERNEL_VERSION;
+            out.minor = std::min<uint32_t>(init->minor, FUSE_KERNEL_MINOR_VERSION);
+            out.max_readahead = init->max_readahead;
+            out.flags = init->flags & (FUSE_ASYNC_READ | FUSE_PARALLEL_DIROPS | FUSE_CACHE_SYMLINKS | FUSE_MAX_PAGES);
+            out.max_background = 16;
+            out.congestion_threshold = 12;
+            out.max_write = 131072;
+            out.time_gran = 1000000000;
+            out.max_pages = 32;
+            if (init->major != FUSE_KERNEL_VERSION) {
+                reply(in.unique, EPROTO);
+            } else {
+                reply(in.unique, 0, &out, sizeof(out));
+            }
+            break;
+        }
+        case FUSE_LOOKUP: {
+            struct fuse_entry_out out = {};
+            std::string path = nodes[id].path;
+            auto it = by_path.find(path.empty() ? arg : path + "/" + arg);
+            // Node 0 is a cached negative lookup, so $PATH searches stay local
+            if (it != by_path.end()) {
+                out.nodeid = it->second;
+                fill_attr(it->second, out.attr);
+                out.attr_valid = TIMEOUT;
+            }
+            out.entry_valid = TIMEOUT;
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+        case FUSE_FORGET:
+        case FUSE_BATCH_FORGET:
+        case FUSE_INTERRUPT:
+            break;  // No reply
+        case FUSE_GETATTR: {
+            struct fuse_attr_out out = {};
+            out.attr_valid = TIMEOUT;
+            fill_attr(id, out.attr);
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+        case FUSE_READLINK: {
+            size_t e = nodes[id].entry;
+            if (e == SIZE_MAX || index.entries[e].type != '2') {
+                reply(in.unique, EINVAL);
+            } else {
+                reply(in.unique, 0, index.entries[e].link.data(), index.entries[e].link.size());
+            }
+            break;
+        }
+        case FUSE_OPEN: {
+            const auto* open_in = reinterpret_cast<const struct fuse_open_in*>(arg);
+            size_t e = nodes[id].entry;
+            if (e == SIZE_MAX || index.entries[e].type != '0') {
+                reply(in.unique, EISDIR);
+                break;
+            }
+            if ((open_in->flags & O_ACCMODE) != O_RDONLY) {
+                reply(in.unique, EROFS);
+                break;
+            }
+            record_hot(index.entries[e].path);
+            int fd = fetch(e) == 0 ? open(cache_path(e).c_str(), O_RDONLY | O_CLOEXEC) : -1;
+            if (fd < 0) {
+                reply(in.unique, EIO);
+                break;
+            }
+            struct fuse_open_out out = {};
+            out.fh = fd;
+            out.open_flags = FOPEN_KEEP_CACHE;
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+        case FUSE_READ: {
+            const auto* read_in = reinterpret_cast<const struct fuse_read_in*>(arg);
+            std::vector<char> data(read_in->size);
+            ssize_t n = pread(read_in->fh, data.data(), data.size(), read_in->offset);
+            if (n < 0) {
+                reply(in.unique, errno);
+            } else {
+                reply(in.unique, 0, data.data(), n);
+            }
+            break;
+        }
+        case FUSE_RELEASE: {
+            close(reinterpret_cast<const struct fuse_release_in*>(arg)->fh);
+            reply(in.unique, 0);
+            break;
+        }
+        case FUSE_OPENDIR: {
+            if (!is_dir(id)) {
+                reply(in.unique, ENOTDIR);
+                break;
+            }
+            struct fuse_open_out out = {};
+            out.open_flags = FOPEN_KEEP_CACHE | FOPEN_CACHE_DIR;
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+        case FUSE_READDIR: {
+            const auto* read_in = reinterpret_cast<const struct fuse_read_in*>(arg);
+            std::string out;
+            const auto& children = nodes[id].children;
+            // Offsets 0 and 1 are "." and ".."; child N is offset N + 2
+            for (uint64_t off = read_in->offset; off < children.size() + 2; off++) {
+                std::string name = off == 0 ? "." : off == 1 ? ".." : children[off - 2].first;
+                uint64_t ino = off < 2 ? id : children[off - 2].second;
+                struct fuse_attr attr;
+                fill_attr(ino, attr);
                 
-                if (std::filesystem::exists(rootfs_path)) {
-                    // Calculate approximate size
-                    size_t size = 0;
-                    try {
-                        for (const auto& file : std::filesystem::recursive_directory_iterator(rootfs_path)) {
-                            if (file.is_regular_file()) {
-                                size += std::filesystem::file_size(file);
-                            }
+                size_t len = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + name.size());
+                if (out.size() + len > read_in->size) break;
+                struct fuse_dirent dirent = {};
+                dirent.ino = ino;
+                dirent.off = off + 1;
+                dirent.namelen = name.size();
+                dirent.type = (attr.mode & S_IFMT) >> 12;
+                size_t start = out.size();
+                out.append(reinterpret_cast<const char*>(&dirent), FUSE_NAME_OFFSET);
+                out += name;
+                out.resize(start + len, '\0');
+            }
+            reply(in.unique, 0, out.data(), out.size());
+            break;
+        }
+        case FUSE_RELEASEDIR:
+        case FUSE_FLUSH:
+            reply(in.unique, 0);
+            break;
+        case FUSE_STATFS: {
+            struct fuse_statfs_out out = {};
+            for (const auto& e : index.entries) out.st.blocks += (e.size + 4095) / 4096;
+            out.st.files = nodes.size() - 1;
+            out.st.bsize = out.st.frsize = 4096;
+            out.st.namelen = 255;
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+        default:
+            // Includes GETXATTR/LISTXATTR: the kernel stops asking, and
+            // overlayfs treats the lower layer as having no xattrs
+            reply(in.unique, ENOSYS);
+            break;
+        }
+    }
+    
+    void record_hot(const std::string& path) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!hot.insert(path).second) return;
+        std::ofstream(image_dir + "/hotset", std::ios::app) << path << "\n";
+    }
+    
+    // Fetches the hot set recorded by earlier runs, in first-open order
+    void prefetch() {
+        std::ifstream hot_file(image_dir + "/hotset");
+        std::string path;
+        size_t count = 0;
+        while (std::getline(hot_file, path)) {
+            auto it = by_path.find(path);
+            if (it == by_path.end() || nodes[it->second].entry == SIZE_MAX) continue;
+            size_t e = nodes[it->second].entry;
+            if (index.entries[e].type != '0' || cached(e)) continue;
+            if (fetch(e) == 0) count++;
+        }
+        if (count > 0) {
+            std::cout << "[LAZY] Prefetched " << count << " hot files" << std::endl;
+        }
+    }
+    
+    bool cached(size_t e) {
+        std::lock_guard<std::mutex> guard(lock);
+        return state[e] == 2;
+    }
+    
+    // Makes entry E's data local; waits if another thread is fetching it
+    int fetch(size_t e) {
+        std::unique_lock<std::mutex> guard(lock);
+        fetched.wait(guard, [&] { return state[e] != 1; });
+        if (state[e] == 2) return 0;
+        state[e] = 1;
+        guard.unlock();
+        
+        int result;
+        if (index.entries[e].size == 0) {
+            int fd = open(cache_path(e).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            result = fd < 0 ? -1 : close(fd);
+            guard.lock();
+            state[e] = result == 0 ? 2 : 0;
+            fetched.notify_all();
+            return result;
+        }
+        return fetch_span(e);
+    }
+    
+    // Inflates from the checkpoint before E through E's data, caching every
+    // file on the way that nobody else is fetching, and the files after E
+    // that end before the next checkpoint: a later open of them would
+    // inflate the same span again
+    int fetch_span(size_t target) {
+        const auto& entries = index.entries;
+        const auto& cp = index.checkpoint_before(entries[target].offset);
+        size_t next = &cp - index.checkpoints.data() + 1;
+        uint64_t span_end = next < index.checkpoints.size() ? index.checkpoints[next].out : UINT64_MAX;
+        uint64_t target_offset = entries[target].offset;
+        auto k = std::lower_bound(by_offset.begin(), by_offset.end(), cp.out, [&](size_t i, uint64_t off) {
+            return entries[i].offset < off;
+        }) - by_offset.begin();
+        
+        std::vector<size_t> claimed = {target};
+        std::vector<size_t> done;
+        int fd = -1;
+        size_t current = SIZE_MAX;      // Being written
+        size_t skipping = SIZE_MAX;     // Cached or someone else's, and not over yet
+        bool target_done = false;
+        
+        auto finish = [&](size_t e, bool ok) {
+            close(fd);
+            fd = -1;
+            current = SIZE_MAX;
+            std::string part = cache_path(e) + ".part";
+            if (ok && rename(part.c_str(), cache_path(e).c_str()) == 0) {
+                done.push_back(e);
+                if (e == target) target_done = true;
+            } else {
+                unlink(part.c_str());
+            }
+        };
+        
+        int result = LazyIndex::inflate_from(url, cp, remote, [&](uint64_t pos, const unsigned char* data, size_t len) {
+            uint64_t end = pos + len;
+            while ((size_t)k < by_offset.size()) {
+                size_t e = by_offset[k];
+                const auto& entry = entries[e];
+                if (entry.offset > target_offset && entry.offset + entry.size > span_end) return false;
+                if (entry.offset >= end) break;
+                
+                if (current != e) {
+                    // First bytes of E: claim it unless it's cached or being fetched
+                    bool mine = e == target;
+                    if (!mine && skipping != e) {
+                        std::lock_guard<std::mutex> guard(lock);
+                        if (state[e] == 0) {
+                            state[e] = 1;
+                            claimed.push_back(e);
+                            mine = true;
                         }
-                    } catch (const std::exception& e) {
-                        size = 0;
                     }
-                    
-                    // Format size
-                    std::string size_str;
-                    if (size < 1024) {
-                        size_str = std::to_string(size) + "B";
-                    } else if (size < 1024 * 1024) {
-                        size_str = std::to_string(size / 1024) + "KB";
-                    } else {
-                        size_str = std::to_string(size / (1024 * 1024)) + "MB";
+                    if (!mine) {
+                        skipping = e;
+                        if (entry.offset + entry.size > end) break;
+                        k++;
+                        continue;
+                    }
+                    current = e;
+                    fd = open((cache_path(e) + ".part").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                    if (fd < 0) {
+                        perror("[LAZY] Failed to create cache file");
+                        return false;
+                    }
+                }
+                
+                uint64_t from = std::max(entry.offset, pos);
+                uint64_t to = std::min(entry.offset + entry.size, end);
+                if (write(fd, data + (from - pos), to - from) != (ssize_t)(to - from)) {
+                    perror("[LAZY] Failed to write cache file");
+                    return false;
+                }
+                if (to < entry.offset + entry.size) break;  // Continues in the next chunk
+                finish(e, true);
+                k++;
+            }
+            return !(target_done && (size_t)k == by_offset.size());
+        });
+        if (current != SIZE_MAX) finish(current, false);
+        
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t e : claimed) {
+            state[e] = std::find(done.begin(), done.end(), e) != done.end() ? 2 : 0;
+        }
+        fetched.notify_all();
+        if (!target_done) {
+            std::cerr << "[LAZY] Failed to fetch " << entries[target].path << (result == 0 ? ": archive ended early" : "") << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+};
+
+class ImageManager {
+private:
+    std::string images_dir = iza_storage_root() + "/images";
+    std::string cache_dir = iza_storage_root() + "/cache";
+    std::string layers_dir = iza_storage_root() + "/layers";   // <sha256>/layer.tar and <sha256>/diff
+    
+public:
+    ImageManager() {
+        // Ensure directories exist
+        std::filesystem::create_directories(images_dir);
+        std::filesystem::create_directories(cache_dir);
+        std::filesystem::create_directories(layers_dir);
+    }
+    
+    int pull_image(const std::string& image_name, const std::string& format = "dir", const std::string& url = "") {
+        std::cout << "[IMAGE] Pulling image: " << image_name << std::endl;
+        
+        // Parse image name (simple format: name:tag)
+        std::string name, tag;
+        size_t colon_pos = image_name.find(':');
+        if (colon_pos != std::string::npos) {
+            name = image_name.substr(0, colon_pos);
+            tag = image_name.substr(colon_pos + 1);
+        } else {
+            name = image_name;
+            tag = "latest";
+        }
+        
+        // For now, we'll download a pre-built minimal rootfs
+        // In a real implementation, this would query Docker Hub API
+        std::string download_url = url;
+        if (!url.empty()) {
+            // Any gzipped rootfs tarball
+        } else if (name == "ubuntu") {
+            // Use a pre-built minimal Ubuntu rootfs
+            download_url = "https://github.com/ianmackinnon/ubuntu-minimal-rootfs/releases/download/20.04/ubuntu-minimal-rootfs-20.04.tar.gz";
+        } else if (name == "alpine") {
+            // Use Alpine Linux minirootfs
+            download_url = "https://dl-cdn.alpinelinux.org/alpine/v3.18/releases/x86_64/alpine-minirootfs-3.18.4-x86_64.tar.gz";
+        } else {
+            std::cerr << "Error: Unsupported image '" << name << "'. Supported: ubuntu, alpine, or --from URL" << std::endl;
+            return -1;
+        }
+        
+        if (format == "lazy") {
+            int result = pull_lazy(image_name, download_url);
+            if (result == 0) {
+                std::cout << "[IMAGE] Successfully pulled " << image_name << " (lazy)" << std::endl;
+            }
+            if (result != 1) return result;
+            // No range support: pull it whole
+        }
+        
+        // Download the image
+        std::string image_path = cache_dir + "/" + image_name + ".tar.gz";
+        if (download_file(download_url, image_path) != 0) {
+            std::cerr << "Failed to download image" << std::endl;
+            return -1;
+        }
+        
+        // Extract the image
+        std::string extract_dir = images_dir + "/" + image_name;
+        unmount_image(extract_dir);
+        if (extract_image(image_path, extract_dir) != 0) {
+            std::cerr << "Failed to extract image" << std::endl;
+            return -1;
+        }
+        
+        if ((format == "erofs" || format == "squashfs") && convert_image(extract_dir, format) != 0) {
+            return -1;
+        }
+        
+        // Identifies this pull's contents to the snapshot drivers' caches
+        Sha256 hash;
+        if (hash.update_file(image_path) == 0) {
+            std::ofstream(extract_dir + "/id") << hash.hex_digest() << "\n";
+        }
+        
+        std::cout << "[IMAGE] Successfully pulled " << image_name << std::endl;
+        return 0;
+    }
+    
+    int list_images() {
+        std::cout << "REPOSITORY          TAG       SIZE\n";
+        std::cout << "==========================================\n";
+        
+        if (!std::filesystem::exists(images_dir)) {
+            std::cout << "(no images found)\n";
+            return 0;
+        }
+        
+        for (const auto& entry : std::filesystem::directory_iterator(images_dir)) {
+            if (entry.is_directory()) {
+                std::string image_name = entry.path().filename().string();
+                std::vector<std::string> layers = read_manifest(image_name);
+                
+                if (!layers.empty()) {
+                    // Calculate approximate size, all layers included; a
+                    // packed base counts as its file, without walking it
+                    size_t size = 0;
+                    std::string format;
+                    try {
+                        for (const auto& line : layers) {
+                            std::string base_dir = images_dir + "/" + line.substr(5);
+                            if (line.starts_with("base:") && std::filesystem::exists(base_dir + "/index")) {
+                                // A lazy image counts what has been fetched so far
+                                format = "lazy";
+                                for (const auto& file : std::filesystem::directory_iterator(base_dir + "/cache")) {
+                                    size += file.file_size();
+                                }
+                                continue;
+                            }
+                            if (line.starts_with("base:") && !(format = compressed_format(base_dir)).empty()) {
+                                size += std::filesystem::file_size(base_dir + "/rootfs." + format);
+                                continue;
+                            }
+                            std::string layer = line.starts_with("sha256:")
+                                ? layers_dir + "/" + line.substr(7) + "/diff" : base_dir + "/rootfs";
+                            for (const auto& file : std::filesystem::recursive_directory_iterator(layer)) {
+                                if (file.is_regular_file()) {
+                                    size += std::filesystem::file_size(file);
+                                }
+                            }
+                        }
+                    } catch (const std::exception& e) {
+                        size = 0;
+                    }
+                    
+                    // Format size
+                    std::string size_str;
+                    if (size < 1024) {
+                        size_str = std::to_string(size) + "B";
+                    } else if (size < 1024 * 1024) {
+                        size_str = std::to_string(size / 1024) + "KB";
+                    } else {
+                        size_str = std::to_string(size / (1024 * 1024)) + "MB";
+                    }
+                    if (!format.empty()) {
+                        size_str += " (" + format + ")";
+                    }
+                    
+                    // Parse name:tag
+                    size_t colon = image_name.find(':');
+                    std::string repo, tag;
+                    if (colon != std::string::npos) {
+                        repo = image_name.substr(0, colon);
+                        tag = image_name.substr(colon + 1);
+                    } else {
+                        repo = image_name;
+                        tag = "latest";
+                    }
+                    
+                    printf("%-20s %-9s %s\n", repo.c_str(), tag.c_str(), size_str.c_str());
+                }
+            }
+        }
+        
+        return 0;
+    }
+    
+    // Lower dirs of an image, topmost first; empty if it or a layer is
+    // missing. Packed base images are loop-mounted on first use.
+    std::vector<std::string> get_image_layers(const std::string& image_name) {
+        std::vector<std::string> layers;
+        for (const auto& line : read_manifest(image_name)) {
+            if (line.starts_with("base:") && mount_image(images_dir + "/" + line.substr(5)) != 0) {
+                return {};
+            }
+            std::string dir = line.starts_with("sha256:")
+                ? layers_dir + "/" + line.substr(7) + "/diff"
+                : images_dir + "/" + line.substr(5) + "/rootfs";
+            if (!std::filesystem::exists(dir)) {
+                std::cerr << "Error: Image '" << image_name << "' is missing layer " << line << std::endl;
+                return {};
+            }
+            layers.push_back(dir);
+        }
+        return layers;
+    }
+    
+    // A pulled image is its rootfs ("base:NAME"); a committed one lists its
+    // layers in images/NAME/layers, "sha256:DIGEST" lines ending in a base
+    std::vector<std::string> read_manifest(const std::string& image_name) {
+        std::string image_dir = images_dir + "/" + image_name;
+        if (std::filesystem::exists(image_dir + "/rootfs")) {
+            return {"base:" + image_name};
+        }
+        
+        std::vector<std::string> lines;
+        std::ifstream manifest(image_dir + "/layers");
+        std::string line;
+        while (std::getline(manifest, line)) {
+            if (line.starts_with("sha256:") || line.starts_with("base:")) {
+                lines.push_back(line);
+            }
+        }
+        return lines;
+    }
+    
+    // "erofs" or "squashfs" if the image's rootfs was packed at pull time
+    static std::string compressed_format(const std::string& image_dir) {
+        for (const char* format : {"erofs", "squashfs"}) {
+            if (std::filesystem::exists(image_dir + "/rootfs." + format)) return format;
+        }
+        return "";
+    }
+    
+    // Stores a container's upper dir as a layer on top of PARENT_IMAGE and
+    // records NEW_IMAGE as that stack. MERGED_DIR supplies what the upper dir
+    // only references: data of metacopy files and redirected directories.
+    int commit_image(const std::string& upper_dir, const std::string& merged_dir,
+                     const std::string& parent_image, const std::string& new_image) {
+        std::vector<std::string> manifest = read_manifest(parent_image);
+        if (manifest.empty()) {
+            std::cerr << "Error: Image '" << parent_image << "' not found" << std::endl;
+            return -1;
+        }
+        
+        std::string image_dir = images_dir + "/" + new_image;
+        if (std::filesystem::exists(image_dir + "/rootfs")) {
+            std::cerr << "Error: '" << new_image << "' is a pulled image; commit under another name" << std::endl;
+            return -1;
+        }
+        
+        std::string tmp_tar = layers_dir + "/.commit-" + std::to_string(getpid()) + ".tar";
+        std::cout << "[COMMIT] Writing layer from " << upper_dir << std::endl;
+        if (write_layer(upper_dir, merged_dir, tmp_tar) != 0) {
+            std::filesystem::remove(tmp_tar);
+            return -1;
+        }
+        
+        Sha256 hash;
+        if (hash.update_file(tmp_tar) != 0) {
+            perror("Failed to read layer");
+            std::filesystem::remove(tmp_tar);
+            return -1;
+        }
+        std::string digest = hash.hex_digest();
+        std::string layer_dir = layers_dir + "/" + digest;
+        
+        // layer.tar is renamed into place last, so its presence marks a complete layer
+        if (std::filesystem::exists(layer_dir + "/layer.tar")) {
+            std::cout << "[COMMIT] Layer sha256:" << digest << " already stored" << std::endl;
+            std::filesystem::remove(tmp_tar);
+        } else {
+            std::filesystem::remove_all(layer_dir);
+            std::filesystem::create_directories(layer_dir + "/diff");
+            if (extract_layer(tmp_tar, layer_dir + "/diff") != 0 ||
+                rename(tmp_tar.c_str(), (layer_dir + "/layer.tar").c_str()) != 0) {
+                std::cerr << "Failed to store layer sha256:" << digest << std::endl;
+                std::filesystem::remove_all(layer_dir);
+                std::filesystem::remove(tmp_tar);
+                return -1;
+            }
+        }
+        
+        std::filesystem::create_directories(image_dir);
+        std::string tmp_manifest = image_dir + "/layers.tmp";
+        std::ofstream out(tmp_manifest);
+        out << "sha256:" << digest << "\n";
+        for (const auto& line : manifest) {
+            out << line << "\n";
+        }
+        out.close();
+        if (out.fail() || rename(tmp_manifest.c_str(), (image_dir + "/layers").c_str()) != 0) {
+            perror("Failed to save image manifest");
+            std::filesystem::remove(tmp_manifest);
+            return -1;
+        }
+        
+        std::cout << "[COMMIT] " << new_image << ": sha256:" << digest << " (" << manifest.size() + 1
+                  << " layers)" << std::endl;
+        return 0;
+    }
+    
+private:
+    int download_file(const std::string& url, const std::string& output_path) {
+        std::cout << "[DOWNLOAD] Downloading from: " << url << std::endl;
+        
+        CURL *curl;
+        CURLcode res;
+        FILE *fp;
+        
+        curl = curl_easy_init();
+        if (!curl) {
+            std::cerr << "Failed to initialize curl" << std::endl;
+            return -1;
+        }
+        
+        fp = fopen(output_path.c_str(), "wb");
+        if (!fp) {
+            std::cerr << "Failed to create output file: " << output_path << std::endl;
+            curl_easy_cleanup(curl);
+            return -1;
+        }
+        
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "iza-container-runtime/1.0");
+        
+        res = curl_easy_perform(curl);
+        
+        fclose(fp);
+        curl_easy_cleanup(curl);
+        
+        if (res != CURLE_OK) {
+            std::cerr << "Download failed: " << curl_easy_strerror(res) << std::endl;
+            std::filesystem::remove(output_path);
+            return -1;
+        }
+        
+        std::cout << "[DOWNLOAD] Downloaded to: " << output_path << std::endl;
+        return 0;
+    }
+    
+    // Packs the extracted rootfs into rootfs.erofs or rootfs.squashfs, one
+    // file instead of a tree of inodes, and leaves rootfs as the empty
+    // directory it gets mounted on. Without the tool or kernel support the
+    // image stays a directory.
+    int convert_image(const std::string& image_dir, const std::string& format) {
+        std::string rootfs_dir = image_dir + "/rootfs";
+        std::string image_file = rootfs_dir + "." + format;
+        std::string tmp_file = image_file + ".tmp";
+        
+        if (!kernel_filesystem(format)) {
+            std::cout << "[CONVERT] This kernel can't mount " << format << "; keeping the extracted rootfs" << std::endl;
+            return 0;
+        }
+        
+        std::cout << "[CONVERT] Packing " << rootfs_dir << " into " << image_file << std::endl;
+        std::filesystem::remove(tmp_file);
+        int result;
+        if (format == "erofs") {
+            // lz4hc: slow to pack once, fast to decompress on every cold start
+            result = run_program({"mkfs.erofs", "-zlz4hc", tmp_file, rootfs_dir});
+        } else {
+            result = run_program({"mksquashfs", rootfs_dir, tmp_file, "-noappend", "-quiet", "-comp", "zstd"});
+            if (result != 0) {
+                // Built without zstd
+                result = run_program({"mksquashfs", rootfs_dir, tmp_file, "-noappend", "-quiet"});
+            }
+        }
+        
+        if (result != 0 || rename(tmp_file.c_str(), image_file.c_str()) != 0) {
+            std::cout << "[CONVERT] " << (format == "erofs" ? "mkfs.erofs (erofs-utils)" : "mksquashfs (squashfs-tools)")
+                      << " failed or is not installed; keeping the extracted rootfs" << std::endl;
+            std::filesystem::remove(tmp_file);
+            return 0;
+        }
+        
+        std::filesystem::remove_all(rootfs_dir);
+        std::filesystem::create_directories(rootfs_dir);
+        std::cout << "[CONVERT] " << format << " image: " << std::filesystem::file_size(image_file) / 1024 << "KB" << std::endl;
+        return 0;
+    }
+    
+    static bool kernel_filesystem(const std::string& type) {
+        std::ifstream filesystems("/proc/filesystems");
+        std::string line;
+        while (std::getline(filesystems, line)) {
+            if (line.substr(line.find('\t') + 1) == type) return true;
+        }
+        return false;
+    }
+    
+    // Mounts a packed or lazy image read-only on its rootfs dir, once; all
+    // its containers share the mount, so its page cache is shared too
+    int mount_image(const std::string& image_dir) {
+        std::string format = compressed_format(image_dir);
+        bool lazy = std::filesystem::exists(image_dir + "/index");
+        if (format.empty() && !lazy) return 0;
+        
+        std::string rootfs_dir = image_dir + "/rootfs";
+        int lock_fd = open((image_dir + "/.mount.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) {
+            perror("Failed to lock image");
+            if (lock_fd >= 0) close(lock_fd);
+            return -1;
+        }
+        
+        int result = 0;
+        if (lazy && server_gone(rootfs_dir)) {
+            umount2(rootfs_dir.c_str(), MNT_DETACH);
+        }
+        if (!is_mountpoint(rootfs_dir)) {
+            if (lazy) {
+                result = mount_lazy(image_dir);
+            } else {
+                std::cout << "[IMAGE] Mounting " << rootfs_dir << "." << format << std::endl;
+                result = loop_mount(rootfs_dir + "." + format, rootfs_dir, format);
+            }
+        }
+        close(lock_fd);
+        return result;
+    }
+    
+    static void unmount_image(const std::string& image_dir) {
+        std::string rootfs_dir = image_dir + "/rootfs";
+        if (server_gone(rootfs_dir) || (std::filesystem::exists(rootfs_dir) && is_mountpoint(rootfs_dir))) {
+            // Running containers keep the old image until they exit
+            umount2(rootfs_dir.c_str(), MNT_DETACH);
+        }
+    }
+    
+    // A lazy image's mount whose server exited. stat() could be answered
+    // from cached attributes; statfs() always asks the server.
+    static bool server_gone(const std::string& rootfs_dir) {
+        struct statfs fs;
+        return statfs(rootfs_dir.c_str(), &fs) != 0 && errno == ENOTCONN;
+    }
+    
+    static bool is_mountpoint(const std::string& path) {
+        struct stat st, parent;
+        return stat(path.c_str(), &st) == 0 &&
+               stat(std::filesystem::path(path).parent_path().c_str(), &parent) == 0 &&
+               st.st_dev != parent.st_dev;
+    }
+    
+    // Attaches FILE to a free loop device and mounts it read-only. Direct
+    // I/O keeps the file's pages out of the page cache next to the
+    // filesystem's own; autoclear frees the device at unmount.
+    static int loop_mount(const std::string& file, const std::string& target, const std::string& type) {
+        int file_fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        int control_fd = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+        if (file_fd < 0 || control_fd < 0) {
+            perror(("Failed to open " + std::string(file_fd < 0 ? file : "/dev/loop-control")).c_str());
+            if (file_fd >= 0) close(file_fd);
+            if (control_fd >= 0) close(control_fd);
+            return -1;
+        }
+        
+        struct loop_config config = {};
+        config.fd = file_fd;
+        config.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO;
+        strncpy(reinterpret_cast<char*>(config.info.lo_file_name), file.c_str(), LO_NAME_SIZE - 1);
+        
+        // Another process may claim the same free device first
+        int loop_fd = -1;
+        int error = 0;
+        std::string device;
+        for (int attempt = 0; attempt < 10 && loop_fd < 0; attempt++) {
+            int number = ioctl(control_fd, LOOP_CTL_GET_FREE);
+            if (number < 0) {
+                error = errno;
+                break;
+            }
+            device = "/dev/loop" + std::to_string(number);
+            loop_fd = open(device.c_str(), O_RDONLY | O_CLOEXEC);
+            if (loop_fd < 0) {
+                error = errno;
+                break;
+            }
+            
+            if (ioctl(loop_fd, LOOP_CONFIGURE, &config) == 0) break;
+            error = errno;
+            if (error == EINVAL || error == ENOTTY) {
+                // Before Linux 5.8: attach, then set flags. SET_STATUS64 can
+                // only change autoclear; the read-only fd makes the device
+                // read-only, and direct I/O has its own ioctl (best effort)
+                struct loop_info64 info = config.info;
+                info.lo_flags = LO_FLAGS_AUTOCLEAR;
+                if (ioctl(loop_fd, LOOP_SET_FD, file_fd) == 0) {
+                    if (ioctl(loop_fd, LOOP_SET_STATUS64, &info) == 0) {
+                        ioctl(loop_fd, LOOP_SET_DIRECT_IO, 1UL);
+                        break;
+                    }
+                    error = errno;
+                    ioctl(loop_fd, LOOP_CLR_FD, 0);
+                } else {
+                    error = errno;
+                }
+            }
+            close(loop_fd);
+            loop_fd = -1;
+            if (error != EBUSY) break;
+        }
+        close(control_fd);
+        close(file_fd);
+        if (loop_fd < 0) {
+            errno = error;
+            perror("Failed to set up loop device");
+            return -1;
+        }
+        
+        int result = mount(device.c_str(), target.c_str(), type.c_str(), MS_RDONLY, nullptr);
+        if (result != 0) {
+            perror(("Failed to mount " + file).c_str());
+        }
+        // The mount holds the device now; without it autoclear detaches it
+        close(loop_fd);
+        return result == 0 ? 0 : -1;
+    }
+    
+    // Indexes the tarball at URL instead of extracting it; files are fetched
+    // when the image is first mounted and opened. An index published next to
+    // the tarball as URL.iza-toc saves streaming it once, if it was built from
+    // the tarball whose sha256 is published as URL.sha256. Returns 1 if the
+    // server can't serve byte ranges.
+    int pull_lazy(const std::string& image_name, const std::string& url) {
+        std::string image_dir = images_dir + "/" + image_name;
+        int probe = LazyIndex::http_get(url, "0-0", [](const char*, size_t) { return true; });
+        if (probe != 0) {
+            if (probe == 1) std::cout << "[LAZY] Pulling the whole image instead" << std::endl;
+            return probe;
+        }
+        
+        // Hashing the tarball here would mean streaming it, which is what the
+        // published index saves, so its digest comes from the publisher too
+        LazyIndex index;
+        LazyIndex::Validator validator;
+        std::string published, digest;
+        long long size = LazyIndex::remote_size(url, &validator);
+        auto fetch = [](const std::string& from, std::string& into) {
+            return LazyIndex::http_get(from, "", [&](const char* data, size_t len) {
+                into.append(data, len);
+                return true;
+            }, true) == 0;
+        };
+        // URL.sha256 may be sha256sum output: the digest, then the file name
+        if (size > 0 && fetch(url + ".sha256", digest)) {
+            digest = digest.substr(0, digest.find_first_of(" \t\r\n"));
+        }
+        if (digest.size() == 64 && fetch(url + ".iza-toc", published) && index.parse(published) == 0 &&
+            index.blob_size == (uint64_t)size && index.blob_digest == digest) {
+            std::cout << "[LAZY] Using published index " << url << ".iza-toc" << std::endl;
+        } else {
+            std::cout << "[LAZY] Indexing " << url << " (streamed, nothing stored)" << std::endl;
+            if (index.build(url) != 0) {
+                return -1;
+            }
+        }
+        
+        // The hot set outlives re-pulls: new versions mostly start the same way
+        unmount_image(image_dir);
+        std::ifstream hot_in(image_dir + "/hotset");
+        std::string hot_set((std::istreambuf_iterator<char>(hot_in)), std::istreambuf_iterator<char>());
+        std::filesystem::remove_all(image_dir);
+        std::filesystem::create_directories(image_dir + "/rootfs");
+        std::ofstream(image_dir + "/source") << url << "\n";
+        // Checked on every range the image's files are later fetched with
+        std::ofstream(image_dir + "/validator") << "etag=" << validator.etag << "\n"
+                                                << "last-modified=" << validator.last_modified << "\n";
+        std::ofstream(image_dir + "/id") << index.blob_digest << "\n";
+        if (!hot_set.empty()) {
+            std::ofstream(image_dir + "/hotset") << hot_set;
+        }
+        if (index.save(image_dir + "/index") != 0) {
+            return -1;
+        }
+        
+        std::cout << "[LAZY] " << index.entries.size() << " entries, " << index.checkpoints.size()
+                  << " checkpoints, " << std::filesystem::file_size(image_dir + "/index") / 1024 << "KB index; publish "
+                  << image_dir << "/index as " << url << ".iza-toc and " << index.blob_digest
+                  << " as " << url << ".sha256 to skip indexing on other hosts" << std::endl;
+        return 0;
+    }
+    
+    // Mounts a lazy image from /dev/fuse and leaves a detached server
+    // process answering it, which exits when the image is unmounted
+    int mount_lazy(const std::string& image_dir) {
+        std::string rootfs_dir = image_dir + "/rootfs";
+        auto server = std::make_unique<LazyImageServer>(image_dir);
+        if (server->load() != 0) {
+            return -1;
+        }
+        
+        int fuse_fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+        if (fuse_fd < 0) {
+            perror("Failed to open /dev/fuse");
+            return -1;
+        }
+        std::string options = "fd=" + std::to_string(fuse_fd) +
+                              ",rootmode=40000,user_id=0,group_id=0,allow_other,default_permissions";
+        std::string source = std::filesystem::path(image_dir).filename().string();
+        std::cout << "[LAZY] Mounting " << rootfs_dir << " from " << image_dir << "/index" << std::endl;
+        if (mount(source.c_str(), rootfs_dir.c_str(), "fuse.iza", MS_RDONLY, options.c_str()) != 0) {
+            perror(("Failed to mount " + rootfs_dir).c_str());
+            close(fuse_fd);
+            return -1;
+        }
+        
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Fork twice so the server isn't this run's child, and setsid so
+            // the terminal's signals don't reach it
+            setsid();
+            if (fork() != 0) _exit(0);
+            if (chdir("/") != 0) _exit(1);
+            int log_fd = open((image_dir + "/server.log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            int null_fd = open("/dev/null", O_RDONLY);
+            dup2(null_fd, STDIN_FILENO);
+            dup2(log_fd, STDOUT_FILENO);
+            dup2(log_fd, STDERR_FILENO);
+            dup2(fuse_fd, 3);
+            // Inherited descriptors include the image's mount lock
+            syscall(SYS_close_range, 4, ~0U, 0);
+            server->serve(3);
+            _exit(0);
+        }
+        close(fuse_fd);
+        if (pid < 0) {
+            perror("Failed to start lazy image server");
+            umount2(rootfs_dir.c_str(), MNT_DETACH);
+            return -1;
+        }
+        waitpid(pid, nullptr, 0);
+        return 0;
+    }
+    
+    int extract_image(const std::string& archive_path, const std::string& extract_dir) {
+        std::cout << "[EXTRACT] Extracting to: " << extract_dir << std::endl;
+        
+        // Remove existing directory
+        std::filesystem::remove_all(extract_dir);
+        
+        // Create directories
+        std::filesystem::create_directories(extract_dir);
+        std::string rootfs_dir = extract_dir + "/rootfs";
+        std::filesystem::create_directories(rootfs_dir);
+        
+        if (extract_layer(archive_path, rootfs_dir) != 0) {
+            return -1;
+        }
+        
+        std::cout << "[EXTRACT] Extraction complete" << std::endl;
+        return 0;
+    }
+    
+    // Unpacks a tarball into ROOTFS_DIR. Layer whiteouts become overlay's:
+    // .wh.NAME a 0/0 character device, .wh..wh..opq an opaque directory.
+    int extract_layer(const std::string& archive_path, const std::string& rootfs_dir) {
+        struct archive *a;
+        struct archive *ext;
+        struct archive_entry *entry;
+        int flags;
+        int r;
+        
+        // Select which attributes we want to restore.
+        flags = ARCHIVE_EXTRACT_TIME;
+        flags |= ARCHIVE_EXTRACT_PERM;
+        flags |= ARCHIVE_EXTRACT_ACL;
+        flags |= ARCHIVE_EXTRACT_FFLAGS;
+        // Entries may not climb out with ".." or through a symlink
+        flags |= ARCHIVE_EXTRACT_SECURE_NODOTDOT;
+        flags |= ARCHIVE_EXTRACT_SECURE_SYMLINKS;
+        
+        a = archive_read_new();
+        archive_read_support_format_all(a);
+        archive_read_support_filter_all(a);
+        ext = archive_write_disk_new();
+        archive_write_disk_set_options(ext, flags);
+        archive_write_disk_set_standard_lookup(ext);
+        
+        if ((r = archive_read_open_filename(a, archive_path.c_str(), 10240))) {
+            std::cerr << "Failed to open archive: " << archive_error_string(a) << std::endl;
+            archive_read_free(a);
+            archive_write_free(ext);
+            return -1;
+        }
+        
+        for (;;) {
+            r = archive_read_next_header(a, &entry);
+            if (r == ARCHIVE_EOF)
+                break;
+            if (r < ARCHIVE_OK)
+                std::cerr << archive_error_string(a) << std::endl;
+            if (r < ARCHIVE_WARN) {
+                archive_read_free(a);
+                archive_write_free(ext);
+                return -1;
+            }
+            
+            // Modify the pathname to extract into our rootfs directory
+            std::string current_file = archive_entry_pathname(entry);
+            std::string new_path = rootfs_dir + "/" + current_file;
+            
+            std::filesystem::path entry_path(new_path);
+            if (entry_path.filename().string().starts_with(".wh.")) {
+                if (apply_whiteout(rootfs_dir, entry_path) != 0) {
+                    archive_read_free(a);
+                    archive_write_free(ext);
+                    return -1;
+                }
+                continue;
+            }
+            archive_entry_set_pathname(entry, new_path.c_str());
+            // Hard link targets are archive paths too
+            const char* hardlink = archive_entry_hardlink(entry);
+            if (hardlink) {
+                if (!archive_path_contained(hardlink)) {
+                    std::cerr << "Refusing hard link " << current_file << " -> " << hardlink << std::endl;
+                    archive_read_free(a);
+                    archive_write_free(ext);
+                    return -1;
+                }
+                archive_entry_set_hardlink(entry, (rootfs_dir + "/" + hardlink).c_str());
+            }
+            
+            r = archive_write_header(ext, entry);
+            if (r < ARCHIVE_OK)
+                std::cerr << archive_error_string(ext) << std::endl;
+            else if (archive_entry_size(entry) > 0) {
+                r = copy_data(a, ext);
+                if (r < ARCHIVE_OK)
+                    std::cerr << archive_error_string(ext) << std::endl;
+                if (r < ARCHIVE_WARN) {
+                    archive_read_free(a);
+                    archive_write_free(ext);
+                    return -1;
+                }
+            }
+            r = archive_write_finish_entry(ext);
+            if (r < ARCHIVE_OK)
+                std::cerr << archive_error_string(ext) << std::endl;
+            if (r < ARCHIVE_WARN) {
+                archive_read_free(a);
+                archive_write_free(ext);
+                return -1;
+            }
+        }
+        
+        archive_read_close(a);
+        archive_read_free(a);
+        archive_write_close(ext);
+        archive_write_free(ext);
+        return 0;
+    }
+    
+    // A relative archive path with no ".." component cannot leave the rootfs
+    static bool archive_path_contained(const std::string& path) {
+        if (path.empty() || path[0] == '/') return false;
+        for (const auto& part : std::filesystem::path(path)) {
+            if (part == "..") return false;
+        }
+        return true;
+    }
+    
+    static int apply_whiteout(const std::string& rootfs_dir, const std::filesystem::path& entry_path) {
+        // Whiteouts bypass libarchive's checks, so confine them here: no ".."
+        // out of the rootfs and no symlinked directory on the way down
+        std::filesystem::path root = std::filesystem::path(rootfs_dir).lexically_normal();
+        std::filesystem::path marker = entry_path.lexically_normal();
+        std::filesystem::path rel = marker.lexically_relative(root);
+        if (rel.empty() || *rel.begin() == ".." || rel.filename() != marker.filename()) {
+            std::cerr << "Refusing whiteout outside the rootfs: " << entry_path << std::endl;
+            return -1;
+        }
+        std::filesystem::path dir = root;
+        for (const auto& part : rel.parent_path()) {
+            dir /= part;
+            struct stat st;
+            if (lstat(dir.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+                std::cerr << "Refusing whiteout through symlink " << dir << std::endl;
+                return -1;
+            }
+        }
+        
+        std::string parent = marker.parent_path().string();
+        std::string name = marker.filename().string();
+        std::filesystem::create_directories(parent);
+        
+        if (name == ".wh..wh..opq") {
+            if (setxattr(parent.c_str(), opaque_xattr(), "y", 1, 0) != 0) {
+                perror(("Failed to mark " + parent + " opaque").c_str());
+                return -1;
+            }
+            return 0;
+        }
+        
+        // Unprivileged users may create whiteout devices too (Linux 5.8+)
+        std::string target = parent + "/" + name.substr(4);
+        if (mknod(target.c_str(), S_IFCHR, makedev(0, 0)) != 0) {
+            perror(("Failed to create whiteout " + target).c_str());
+            return -1;
+        }
+        return 0;
+    }
+    
+    // Rootless overlays are mounted with userxattr
+    static const char* opaque_xattr() {
+        return geteuid() == 0 ? "trusted.overlay.opaque" : "user.overlay.opaque";
+    }
+    
+    static bool has_overlay_xattr(const std::string& path, const std::string& name, const char* value = nullptr) {
+        for (const char* prefix : {"trusted.overlay.", "user.overlay."}) {
+            char buf[8];
+            ssize_t len = lgetxattr(path.c_str(), (prefix + name).c_str(), buf, sizeof(buf));
+            if (len >= 0 && (value == nullptr || std::string(buf, len) == value)) return true;
+            if (len < 0 && errno == ERANGE && value == nullptr) return true;
+        }
+        return false;
+    }
+    
+    // Writes UPPER_DIR as a layer tarball. Overlay's whiteouts (0/0 character
+    // devices) become .wh.NAME entries and opaque directories get .wh..wh..opq.
+    int write_layer(const std::string& upper_dir, const std::string& merged_dir, const std::string& tar_path) {
+        struct archive* a = archive_write_new();
+        archive_write_set_format_pax_restricted(a);
+        if (archive_write_open_filename(a, tar_path.c_str()) != ARCHIVE_OK) {
+            std::cerr << "Failed to create layer: " << archive_error_string(a) << std::endl;
+            archive_write_free(a);
+            return -1;
+        }
+        
+        int result = write_layer_dir(a, upper_dir, merged_dir, "");
+        if (archive_write_close(a) != ARCHIVE_OK) {
+            std::cerr << "Failed to write layer: " << archive_error_string(a) << std::endl;
+            result = -1;
+        }
+        archive_write_free(a);
+        return result;
+    }
+    
+    // Entries are sorted so the same tree always gives the same digest
+    int write_layer_dir(struct archive* a, const std::string& dir, const std::string& merged_dir,
+                        const std::string& prefix) {
+        std::vector<std::string> names;
+        try {
+            for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+                names.push_back(entry.path().filename().string());
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to read " << dir << ": " << e.what() << std::endl;
+            return -1;
+        }
+        std::sort(names.begin(), names.end());
+        
+        for (const auto& name : names) {
+            std::string path = dir + "/" + name;
+            std::string layer_path = prefix + name;
+            struct stat st;
+            if (lstat(path.c_str(), &st) != 0) {
+                perror(("Failed to stat " + path).c_str());
+                return -1;
+            }
+            
+            if (S_ISCHR(st.st_mode) && st.st_rdev == makedev(0, 0)) {
+                if (write_whiteout(a, prefix + ".wh." + name, st) != 0) return -1;
+                continue;
+            }
+            
+            // Metacopy files hold only metadata; the data is in a lower layer
+            std::string data_path = S_ISREG(st.st_mode) && has_overlay_xattr(path, "metacopy")
+                ? merged_dir + "/" + layer_path : path;
+            if (write_layer_entry(a, path, data_path, layer_path, st) != 0) return -1;
+            if (!S_ISDIR(st.st_mode)) continue;
+            
+            // A renamed directory's contents stay in the lower layer; take them from the merged view
+            bool redirected = has_overlay_xattr(path, "redirect");
+            if (redirected || has_overlay_xattr(path, "opaque", "y")) {
+                if (write_whiteout(a, layer_path + "/.wh..wh..opq", st) != 0) return -1;
+            }
+            std::string source = redirected ? merged_dir + "/" + layer_path : path;
+            if (write_layer_dir(a, source, merged_dir, layer_path + "/") != 0) return -1;
+        }
+        return 0;
+    }
+    
+    static int write_whiteout(struct archive* a, const std::string& layer_path, const struct stat& st) {
+        struct archive_entry* entry = archive_entry_new();
+        archive_entry_set_pathname(entry, layer_path.c_str());
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, 0);
+        archive_entry_set_mtime(entry, st.st_mtime, 0);
+        int r = archive_write_header(a, entry);
+        archive_entry_free(entry);
+        if (r < ARCHIVE_OK) {
+            std::cerr << "Failed to write " << layer_path << ": " << archive_error_string(a) << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    
+    static int write_layer_entry(struct archive* a, const std::string& path, const std::string& data_path,
+                                 const std::string& layer_path, const struct stat& st) {
+        struct archive_entry* entry = archive_entry_new();
+        archive_entry_copy_stat(entry, &st);
+        archive_entry_set_pathname(entry, layer_path.c_str());
+        
+        if (S_ISLNK(st.st_mode)) {
+            char target[PATH_MAX];
+            ssize_t len = readlink(path.c_str(), target, sizeof(target) - 1);
+            if (len < 0) {
+                perror(("Failed to read link " + path).c_str());
+                archive_entry_free(entry);
+                return -1;
+            }
+            target[len] = '\0';
+            archive_entry_set_symlink(entry, target);
+        }
+        
+        int fd = -1;
+        if (S_ISREG(st.st_mode) && (fd = open(data_path.c_str(), O_RDONLY | O_CLOEXEC)) < 0) {
+            perror(("Failed to open " + data_path).c_str());
+            archive_entry_free(entry);
+            return -1;
+        }
+        
+        int result = archive_write_header(a, entry) < ARCHIVE_OK ? -1 : 0;
+        char buf[65536];
+        ssize_t n = 0;
+        while (result == 0 && fd >= 0 && (n = read(fd, buf, sizeof(buf))) > 0) {
+            if (archive_write_data(a, buf, n) != n) result = -1;
+        }
+        if (n < 0) result = -1;
+        if (fd >= 0) close(fd);
+        archive_entry_free(entry);
+        
+        if (result != 0) {
+            std::cerr << "Failed to write " << layer_path << ": " << archive_error_string(a) << std::endl;
+        }
+        return result;
+    }
+    
+    static int copy_data(struct archive *ar, struct archive *aw) {
+        int r;
+        const void *buff;
+        size_t size;
+        la_int64_t offset;
+        
+        for (;;) {
+            r = archive_read_data_block(ar, &buff, &size, &offset);
+            if (r == ARCHIVE_EOF)
+                return (ARCHIVE_OK);
+            if (r < ARCHIVE_OK)
+                return (r);
+            r = archive_write_data_block(aw, buff, size, offset);
+            if (r < ARCHIVE_OK) {
+                std::cerr << archive_error_string(aw) << std::endl;
+                return (r);
+            }
+        }
+    }
+};
+
+// A bind mount inherits the source's flags; read-only takes a remount. In a
+// user namespace the source's nosuid/nodev/noexec are locked and must be
+// repeated, or the remount fails with EPERM.
+int remount_one_read_only(const std::string& target) {
+    unsigned long flags = MS_REMOUNT | MS_BIND | MS_RDONLY;
+    struct statvfs vfs;
+    if (statvfs(target.c_str(), &vfs) == 0) {
+        if (vfs.f_flag & ST_NOSUID) flags |= MS_NOSUID;
+        if (vfs.f_flag & ST_NODEV) flags |= MS_NODEV;
+        if (vfs.f_flag & ST_NOEXEC) flags |= MS_NOEXEC;
+        if (vfs.f_flag & ST_NOATIME) flags |= MS_NOATIME;
+        if (vfs.f_flag & ST_NODIRATIME) flags |= MS_NODIRATIME;
+        if (vfs.f_flag & ST_RELATIME) flags |= MS_RELATIME;
+    }
+    if (mount(nullptr, target.c_str(), nullptr, flags, nullptr) != 0) {
+        perror(("Failed to make " + target + " read-only").c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// Read-only for TARGET and every mount below it, which an MS_REC bind
+// brings along: mount_setattr (Linux 5.12+) does the whole tree at once,
+// older kernels get one remount per mount listed in mountinfo
+int remount_read_only(const std::string& target) {
+    struct mount_attr attr = {};
+    attr.attr_set = MOUNT_ATTR_RDONLY;
+    if (syscall(SYS_mount_setattr, AT_FDCWD, target.c_str(), AT_RECURSIVE, &attr, sizeof(attr)) == 0) {
+        return 0;
+    }
+    
+    std::vector<std::string> mounts = {target};
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    std::string line;
+    while (std::getline(mountinfo, line)) {
+        // ID PARENT MAJ:MIN ROOT MOUNTPOINT ...; spaces in paths are \040
+        std::istringstream fields(line);
+        std::string field, mount_point;
+        for (int i = 0; i < 5 && fields >> field; i++) mount_point = field;
+        std::string decoded;
+        for (size_t i = 0; i < mount_point.size(); i++) {
+            if (mount_point[i] == '\\' && i + 3 < mount_point.size()) {
+                decoded += (char)std::stoi(mount_point.substr(i + 1, 3), nullptr, 8);
+                i += 3;
+            } else {
+                decoded += mount_point[i];
+            }
+        }
+        if (decoded.starts_with(target + "/")) mounts.push_back(decoded);
+    }
+    for (const auto& mount_point : mounts) {
+        if (remount_one_read_only(mount_point) != 0) return -1;
+    }
+    return 0;
+}
+
+// Rootless mode: without real root, containers get their own user namespace
+// in which the invoking user is root
+class UserNamespace {
+public:
+    static bool rootless() {
+        return geteuid() != 0;
+    }
+    
+    // Maps container root to the invoking user, plus the user's subordinate
+    // ranges from /etc/subuid and /etc/subgid when the setuid newuidmap and
+    // newgidmap helpers are installed. Without them only root is mapped.
+    static int setup_id_maps(pid_t pid) {
+        uid_t uid = getuid();
+        gid_t gid = getgid();
+        std::string pid_str = std::to_string(pid);
+        
+        struct passwd* pw = getpwuid(uid);
+        std::string user = pw != nullptr ? pw->pw_name : "";
+        
+        long long uid_start, uid_count, gid_start, gid_count;
+        if (subordinate_range("/etc/subuid", user, uid, uid_start, uid_count) == 0 &&
+            subordinate_range("/etc/subgid", user, gid, gid_start, gid_count) == 0) {
+            if (run_program({"newuidmap", pid_str, "0", std::to_string(uid), "1",
+                             "1", std::to_string(uid_start), std::to_string(uid_count)}) == 0 &&
+                run_program({"newgidmap", pid_str, "0", std::to_string(gid), "1",
+                             "1", std::to_string(gid_start), std::to_string(gid_count)}) == 0) {
+                std::cout << "[USERNS] Mapped root to " << uid << " and 1-" << uid_count
+                          << " to subordinate IDs from " << uid_start << std::endl;
+                return 0;
+            }
+            std::cout << "[USERNS] newuidmap/newgidmap failed, mapping root only" << std::endl;
+        }
+        
+        // An unprivileged process may map exactly its own IDs, and only after
+        // giving up setgroups(2)
+        std::string proc = "/proc/" + pid_str;
+        if (write_proc_file(proc + "/setgroups", "deny") != 0 ||
+            write_proc_file(proc + "/uid_map", "0 " + std::to_string(uid) + " 1\n") != 0 ||
+            write_proc_file(proc + "/gid_map", "0 " + std::to_string(gid) + " 1\n") != 0) {
+            return -1;
+        }
+        std::cout << "[USERNS] Mapped root to " << uid << " (no subordinate IDs)" << std::endl;
+        return 0;
+    }
+    
+    // Removes PATH from inside a user namespace with the same maps, so files
+    // the container created as subordinate IDs can be deleted too
+    static int remove_with_id_maps(const std::string& path) {
+        int sync_pipe[2];
+        if (pipe2(sync_pipe, O_CLOEXEC) != 0) return -1;
+        
+        struct Job {
+            std::string path;
+            int sync_fd, sync_write_fd;
+        } job = {path, sync_pipe[0], sync_pipe[1]};
+        
+        auto remover = [](void* arg) -> int {
+            Job* job = static_cast<Job*>(arg);
+            close(job->sync_write_fd);  // Or a dead parent never gives EOF
+            char ready;
+            if (read(job->sync_fd, &ready, 1) != 1) return 1;
+            std::error_code ec;
+            std::filesystem::remove_all(job->path, ec);
+            return ec ? 1 : 0;
+        };
+        
+        const size_t stack_size = 256 * 1024;
+        std::vector<char> stack(stack_size);
+        pid_t pid = clone(remover, stack.data() + stack_size, CLONE_NEWUSER | SIGCHLD, &job);
+        close(sync_pipe[0]);
+        if (pid < 0) {
+            close(sync_pipe[1]);
+            return -1;
+        }
+        
+        bool mapped = setup_id_maps(pid) == 0 && write(sync_pipe[1], "1", 1) == 1;
+        close(sync_pipe[1]);
+        
+        int status;
+        waitpid(pid, &status, 0);
+        return mapped && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+    }
+    
+private:
+    // "name:start:count" (or "uid:start:count") for this user
+    static int subordinate_range(const std::string& file, const std::string& user, unsigned id,
+                                 long long& start, long long& count) {
+        std::ifstream in(file);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::stringstream ss(line);
+            std::string owner, first, length;
+            if (!std::getline(ss, owner, ':') || !std::getline(ss, first, ':') || !std::getline(ss, length)) continue;
+            if (owner != user && owner != std::to_string(id)) continue;
+            
+            try {
+                start = std::stoll(first);
+                count = std::stoll(length);
+                return count > 0 ? 0 : -1;
+            } catch (const std::exception& e) {
+                continue;
+            }
+        }
+        return -1;
+    }
+    
+    static int write_proc_file(const std::string& file, const std::string& value) {
+        int fd = open(file.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0 || write(fd, value.c_str(), value.size()) != (ssize_t)value.size()) {
+            perror(("Failed to write " + file).c_str());
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        close(fd);
+        return 0;
+    }
+};
+
+// How a container's root filesystem is made from its image layers. The
+// parent prepares it on the host, the container finishes it from inside its
+// mount namespace, "iza diff" asks what changed, and cleanup removes it.
+class StorageDriver {
+public:
+    virtual ~StorageDriver() = default;
+    virtual std::string name() const = 0;
+    
+    // LOWER_DIRS lists the image's layers, topmost first; ROOTFS is set to
+    // the directory the container will chroot into
+    virtual int prepare(const std::vector<std::string>& lower_dirs, const std::string& container_id,
+                        std::string& rootfs, bool read_only) = 0;
+    virtual int mount(const std::string& rootfs, bool read_only) = 0;
+    // The tree prepare() cloned ROOTFS from; empty for drivers that mount the layers
+    virtual std::string base() const {
+        return "";
+    }
+    // Sorted (path, 'A'|'C'|'D') pairs. BASE is what base() returned at prepare().
+    virtual int diff(const std::string& rootfs, const std::vector<std::string>& lower_dirs,
+                     const std::string& base, std::vector<std::pair<std::string, char>>& changes) = 0;
+    virtual int cleanup(const std::string& container_id) = 0;
+};
+
+// Lists what a container changed from its overlay upper dir alone: every
+// entry there was added or changed, 0/0 character devices are deletions and
+// opaque directories hide what their lower counterparts held. Lower layers
+// are only probed per path, never walked, except below opaque directories.
+class UpperDirScanner {
+private:
+    int upper_fd = -1;
+    std::vector<int> lower_fds;         // Topmost first
+    
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<std::string> pending;    // Directories left to scan, relative to the upper dir
+    int busy = 0;
+    std::vector<std::pair<std::string, char>> changes;
+    bool failed = false;
+    
+public:
+    UpperDirScanner(const std::string& upper_dir, const std::vector<std::string>& lower_dirs) {
+        upper_fd = open(upper_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        for (const auto& dir : lower_dirs) {
+            int fd = open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+            if (fd >= 0) lower_fds.push_back(fd);
+        }
+    }
+    
+    ~UpperDirScanner() {
+        if (upper_fd >= 0) close(upper_fd);
+        for (int fd : lower_fds) {
+            close(fd);
+        }
+    }
+    
+    // Sorted (path, 'A'|'C'|'D') pairs
+    int scan(std::vector<std::pair<std::string, char>>& result) {
+        if (upper_fd < 0) {
+            perror("Failed to open upper dir");
+            return -1;
+        }
+        
+        pending.push_back("");
+        unsigned workers = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+        std::vector<std::thread> threads;
+        for (unsigned k = 0; k < workers; k++) {
+            threads.emplace_back([this] { worker(); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        
+        std::sort(changes.begin(), changes.end());
+        result = changes;
+        return failed ? -1 : 0;
+    }
+    
+private:
+    void worker() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wakeup.wait(lock, [this] { return !pending.empty() || busy == 0; });
+            if (pending.empty()) break;
+            
+            std::string dir = pending.front();
+            pending.pop_front();
+            busy++;
+            lock.unlock();
+            
+            std::vector<std::pair<std::string, char>> found;
+            std::vector<std::string> subdirs;
+            bool ok = scan_dir(dir, found, subdirs) == 0;
+            
+            lock.lock();
+            changes.insert(changes.end(), found.begin(), found.end());
+            pending.insert(pending.end(), subdirs.begin(), subdirs.end());
+            failed = failed || !ok;
+            busy--;
+            wakeup.notify_all();
+        }
+    }
+    
+    // One directory with raw getdents64: d_type avoids a stat per entry,
+    // only character devices need one to tell whiteouts apart
+    int scan_dir(const std::string& dir, std::vector<std::pair<std::string, char>>& found,
+                 std::vector<std::string>& subdirs) {
+        int fd = openat(upper_fd, dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            perror(("Failed to open " + dir).c_str());
+            return -1;
+        }
+        
+        std::set<std::string> names;
+        char buf[32768];
+        long n;
+        while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+            for (long offset = 0; offset < n;) {
+                // struct linux_dirent64: ino, off, reclen, type, name
+                unsigned short reclen;
+                memcpy(&reclen, buf + offset + 16, sizeof(reclen));
+                unsigned char type = buf[offset + 18];
+                std::string name = buf + offset + 19;
+                offset += reclen;
+                if (name == "." || name == "..") continue;
+                
+                std::string path = dir.empty() ? name : dir + "/" + name;
+                names.insert(name);
+                
+                struct stat st;
+                if ((type == DT_CHR || type == DT_UNKNOWN) && fstatat(fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    if (S_ISCHR(st.st_mode) && st.st_rdev == makedev(0, 0)) {
+                        found.push_back({"/" + path, 'D'});
+                        continue;
+                    }
+                    if (S_ISDIR(st.st_mode)) type = DT_DIR;
+                }
+                
+                found.push_back({"/" + path, in_lower(path) ? 'C' : 'A'});
+                if (type == DT_DIR) subdirs.push_back(path);
+            }
+        }
+        if (n < 0) {
+            perror(("Failed to read " + dir).c_str());
+            close(fd);
+            return -1;
+        }
+        
+        if (!dir.empty() && is_opaque(fd)) {
+            // Everything the lower layers had here and the upper dir doesn't is gone
+            for (const auto& name : lower_names(dir)) {
+                if (!names.count(name)) found.push_back({"/" + dir + "/" + name, 'D'});
+            }
+        }
+        close(fd);
+        return 0;
+    }
+    
+    // The topmost layer holding PATH decides; a whiteout there means it's
+    // deleted, and an opaque directory, a whiteout or any other non-directory
+    // above it hides the layers below. Symlinks in a layer are entries like
+    // any other, never followed: lib -> usr/lib is not a directory here.
+    bool in_lower(const std::string& path) {
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "" : path.substr(0, slash);
+        std::string name = path.substr(slash + 1);
+        for (int fd : lower_fds) {
+            bool hidden = false;
+            int dir_fd = open_layer_dir(fd, dir, hidden);
+            struct stat st;
+            bool found = dir_fd >= 0 && fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+            if (dir_fd >= 0) close(dir_fd);
+            if (found) {
+                return !(S_ISCHR(st.st_mode) && st.st_rdev == makedev(0, 0));
+            }
+            if (hidden) return false;
+        }
+        return false;
+    }
+    
+    // Opens DIR ("" for the root) of the layer at FD one component at a time
+    // with O_NOFOLLOW. Returns -1 if DIR isn't a directory in the layer.
+    // HIDDEN is set when DIR or an ancestor there is opaque or not a
+    // directory: the layers below have nothing under DIR then.
+    static int open_layer_dir(int fd, const std::string& dir, bool& hidden) {
+        int current = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        size_t start = 0;
+        while (current >= 0 && !dir.empty() && start <= dir.size()) {
+            size_t end = dir.find('/', start);
+            if (end == std::string::npos) end = dir.size();
+            std::string part = dir.substr(start, end - start);
+            start = end + 1;
+            
+            struct stat st;
+            int next = -1;
+            if (fstatat(current, part.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                if (!S_ISDIR(st.st_mode)) {
+                    hidden = true;
+                } else {
+                    next = openat(current, part.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                    if (next >= 0 && is_opaque(next)) hidden = true;
+                }
+            }
+            close(current);
+            current = next;
+        }
+        return current;
+    }
+    
+    static bool is_opaque(int fd) {
+        char value[2];
+        for (const char* name : {"trusted.overlay.opaque", "user.overlay.opaque"}) {
+            if (fgetxattr(fd, name, value, sizeof(value)) == 1 && value[0] == 'y') return true;
+        }
+        return false;
+    }
+    
+    std::set<std::string> lower_names(const std::string& dir) {
+        std::set<std::string> names;
+        for (int lower_fd : lower_fds) {
+            // A non-directory here (a symlink too) has no children to list
+            bool hidden = false;
+            int fd = open_layer_dir(lower_fd, dir, hidden);
+            if (fd < 0) continue;
+            DIR* listing = fdopendir(fd);
+            if (listing == nullptr) {
+                close(fd);
+                continue;
+            }
+            while (struct dirent* entry = readdir(listing)) {
+                std::string name = entry->d_name;
+                if (name != "." && name != ".." && in_lower(dir + "/" + name)) names.insert(name);
+            }
+            closedir(listing);
+        }
+        return names;
+    }
+};
+
+class OverlayFS : public StorageDriver {
+private:
+    std::string overlay_dir = iza_storage_root() + "/overlay";
+    bool overlay_supported = false;
+    std::string extra_options;          // --overlay-opts, e.g. "volatile,metacopy=on"
+    
+public:
+    OverlayFS() {
+        std::filesystem::create_directories(overlay_dir);
+        
+        // Check if OverlayFS is supported
+        std::ifstream filesystems("/proc/filesystems");
+        std::string line;
+        while (std::getline(filesystems, line)) {
+            if (line.find("overlay") != std::string::npos) {
+                overlay_supported = true;
+                break;
+            }
+        }
+    }
+    
+    std::string name() const override {
+        return "overlay";
+    }
+    
+    bool available() const {
+        return overlay_supported;
+    }
+    
+    void set_options(const std::string& options) {
+        extra_options = options;
+    }
+    
+    // ",opt,opt" with the options the running kernel supports; the others are
+    // dropped with a warning rather than failing the mount
+    static std::string supported_options(const std::string& options, bool userxattr) {
+        std::string result;
+        std::stringstream list(options);
+        std::string option;
+        while (std::getline(list, option, ',')) {
+            if (option.empty()) continue;
+            std::string name = option.substr(0, option.find('='));
+            
+            std::string reason;
+            if (name == "volatile") {
+                // Linux 5.10+; there is no module parameter to probe
+                if (!kernel_at_least(5, 10)) reason = "needs Linux 5.10";
+            } else if (!std::filesystem::exists("/sys/module/overlay/parameters/" + name)) {
+                reason = "not supported by this kernel";
+            } else if (userxattr && (name == "metacopy" || name == "redirect_dir") && !option.ends_with("=off")) {
+                // Both rely on trusted.* xattrs
+                reason = "not allowed in a user namespace";
+            }
+            
+            if (!reason.empty()) {
+                std::cout << "[OVERLAY] Ignoring " << option << ": " << reason << std::endl;
+                continue;
+            }
+            result += "," + option;
+        }
+        return result;
+    }
+    
+    int prepare(const std::vector<std::string>& lower_dirs, const std::string& container_id,
+                std::string& merged_dir, bool read_only) override {
+        // Create directories for this container
+        std::string container_overlay = overlay_dir + "/" + container_id;
+        std::string upper_dir = container_overlay + "/upper";
+        std::string work_dir = container_overlay + "/work";
+        merged_dir = container_overlay + "/merged";
+        
+        // Clean up any existing overlay
+        cleanup(container_id);
+        
+        if (read_only) {
+            // Nothing is ever written, so no upper or work dir: the image itself, read-only
+            std::filesystem::create_directories(merged_dir);
+            if (UserNamespace::rootless()) {
+                if (!namespace_mount_works(join_lower_dirs(lower_dirs), merged_dir, true)) {
+                    cleanup(container_id);
+                    return -1;
+                }
+                setenv("IZA_OVERLAY_LOWER", join_lower_dirs(lower_dirs).c_str(), 1);
+                return 0;
+            }
+            return mount_lower_dirs(lower_dirs, merged_dir, false);
+        }
+        
+        // Create directories
+        std::filesystem::create_directories(upper_dir);
+        std::filesystem::create_directories(work_dir);
+        std::filesystem::create_directories(merged_dir);
+        
+        if (overlay_supported && UserNamespace::rootless()) {
+            // Only the container's user namespace may mount it; see mount_in_namespace
+            setenv("IZA_OVERLAY_OPTS", extra_options.c_str(), 1);
+            if (!namespace_mount_works(join_lower_dirs(lower_dirs), merged_dir, false)) {
+                cleanup(container_id);
+                return -1;
+            }
+            setenv("IZA_OVERLAY_LOWER", join_lower_dirs(lower_dirs).c_str(), 1);
+            return 0;
+        }
+        
+        if (!overlay_supported) {
+            std::cerr << "[OVERLAY] OverlayFS not available" << std::endl;
+            return -1;
+        }
+        
+        std::string options = supported_options(extra_options, false);
+        std::cout << "[OVERLAY] Mounting overlay: lowerdir=" << join_lower_dirs(lower_dirs) << ",upperdir=" << upper_dir
+                  << ",workdir=" << work_dir << options << std::endl;
+        if (mount_overlay(lower_dirs, upper_dir, work_dir, options, merged_dir) != 0) {
+            perror("[OVERLAY] Mount failed");
+            cleanup(container_id);
+            return -1;
+        }
+        return 0;
+    }
+    
+    int mount(const std::string& rootfs, bool read_only) override {
+        char* env_lower = getenv("IZA_OVERLAY_LOWER");
+        return env_lower != nullptr ? mount_in_namespace(env_lower, rootfs, read_only) : 0;
+    }
+    
+    int diff(const std::string& rootfs, const std::vector<std::string>& lower_dirs, const std::string& base,
+             std::vector<std::pair<std::string, char>>& changes) override {
+        (void)base;
+        std::string upper_dir = std::filesystem::path(rootfs).parent_path().string() + "/upper";
+        if (!std::filesystem::exists(upper_dir)) {
+            std::cerr << "Error: The container has no writable layer (--read-only)" << std::endl;
+            return -1;
+        }
+        UpperDirScanner scanner(upper_dir, lower_dirs);
+        return scanner.scan(changes);
+    }
+    
+    // Rootless half of prepare, run by the container process once it is
+    // root in its user namespace (Linux 5.11+). userxattr keeps overlay's
+    // metadata in user.* xattrs, which need no privilege on the host.
+    static int mount_in_namespace(const std::string& lower, const std::string& merged_dir, bool read_only) {
+        std::vector<std::string> lower_dirs = split_lower_dirs(lower);
+        if (read_only) {
+            return mount_lower_dirs(lower_dirs, merged_dir, true);
+        }
+        
+        std::string container_overlay = std::filesystem::path(merged_dir).parent_path();
+        const char* env_opts = getenv("IZA_OVERLAY_OPTS");
+        std::string options = ",userxattr" + supported_options(env_opts != nullptr ? env_opts : "", true);
+        
+        std::cout << "[OVERLAY] Mounting overlay in user namespace: lowerdir=" << lower << options << std::endl;
+        if (mount_overlay(lower_dirs, container_overlay + "/upper", container_overlay + "/work",
+                          options, merged_dir) == 0) {
+            return 0;
+        }
+        
+        // prepare tried this already, so a copy here would only hide the
+        // wrong driver from the record, diff and commit
+        perror("[OVERLAY] Unprivileged OverlayFS mount failed");
+        return -1;
+    }
+    
+    // Rootless prepare: whether the container's user namespace will be able
+    // to mount the overlay, tried in a throwaway user and mount namespace so
+    // that prepare_storage can still pick another driver. The probe gets
+    // scratch upper and work dirs: a volatile mount leaves a marker in its
+    // work dir that would make the container's own mount refuse it.
+    static bool namespace_mount_works(const std::string& lower, const std::string& merged_dir, bool read_only) {
+        std::string probe = std::filesystem::path(merged_dir).parent_path().string() + "/probe";
+        std::string probe_merged = read_only ? merged_dir : probe + "/merged";
+        if (!read_only) {
+            std::error_code ec;
+            for (const char* dir : {"/upper", "/work", "/merged"}) {
+                std::filesystem::create_directories(probe + dir, ec);
+            }
+        }
+        
+        uid_t uid = geteuid();
+        gid_t gid = getegid();
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if (unshare(CLONE_NEWUSER | CLONE_NEWNS) != 0) _exit(1);
+            std::ofstream("/proc/self/setgroups") << "deny";
+            std::ofstream("/proc/self/uid_map") << "0 " << uid << " 1";
+            std::ofstream("/proc/self/gid_map") << "0 " << gid << " 1";
+            int result = mount_in_namespace(lower, probe_merged, read_only);
+            if (!read_only) {
+                // Overlay's work/work is mode 000; only root here may clear it
+                umount(probe_merged.c_str());
+                std::error_code ec;
+                std::filesystem::remove_all(probe, ec);
+            }
+            _exit(result == 0 ? 0 : 1);
+        }
+        
+        int status;
+        bool works = pid >= 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!read_only) {
+            std::error_code ec;
+            std::filesystem::remove_all(probe, ec);
+        }
+        if (!works) {
+            std::cout << "[OVERLAY] Unprivileged OverlayFS mount failed" << std::endl;
+        }
+        return works;
+    }
+    
+    // Mount an overlay of LOWER_DIRS (topmost first). The new mount API adds
+    // one lowerdir+ per layer (Linux 6.8+), so the layer stack isn't bounded
+    // by mount(2)'s one-page option string; older kernels fall back to
+    // mount(2). Without UPPER_DIR the overlay is read-only. OPTIONS is
+    // ",opt,opt" as from supported_options.
+    static int mount_overlay(const std::vector<std::string>& lower_dirs, const std::string& upper_dir,
+                             const std::string& work_dir, const std::string& options,
+                             const std::string& merged_dir) {
+        int fs_fd = syscall(SYS_fsopen, "overlay", FSOPEN_CLOEXEC);
+        if (fs_fd >= 0) {
+            int result = configure_overlay(fs_fd, lower_dirs, upper_dir, work_dir, options);
+            if (result == 0) {
+                int mount_fd = syscall(SYS_fsmount, fs_fd, FSMOUNT_CLOEXEC, 0);
+                if (mount_fd >= 0) {
+                    result = syscall(SYS_move_mount, mount_fd, "", AT_FDCWD, merged_dir.c_str(),
+                                     MOVE_MOUNT_F_EMPTY_PATH);
+                    close(mount_fd);
+                } else {
+                    result = -1;
+                }
+            }
+            
+            int saved_errno = errno;
+            if (result != 0 && result != 1) print_fs_log(fs_fd);
+            close(fs_fd);
+            errno = saved_errno;
+            if (result != 1) return result;
+            // lowerdir+ unknown: a pre-6.8 kernel, take the mount(2) path
+        }
+        
+        std::string mount_opts = "lowerdir=" + join_lower_dirs(lower_dirs) + options;
+        if (!upper_dir.empty()) {
+            mount_opts += ",upperdir=" + upper_dir + ",workdir=" + work_dir;
+        }
+        if (mount_opts.size() >= (size_t)sysconf(_SC_PAGESIZE)) {
+            std::cerr << "[OVERLAY] Overlay options exceed one page (" << mount_opts.size()
+                      << " bytes); this kernel needs Linux 6.8 for more layers" << std::endl;
+            errno = E2BIG;
+            return -1;
+        }
+        return ::mount("overlay", merged_dir.c_str(), "overlay", 0, mount_opts.c_str());
+    }
+    
+    // Returns 1 if the kernel doesn't know lowerdir+
+    static int configure_overlay(int fs_fd, const std::vector<std::string>& lower_dirs, const std::string& upper_dir,
+                                 const std::string& work_dir, const std::string& options) {
+        bool first = true;
+        for (const auto& layer : lower_dirs) {
+            if (syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, "lowerdir+", layer.c_str(), 0) != 0) {
+                return first && errno == EINVAL ? 1 : -1;
+            }
+            first = false;
+        }
+        
+        if (!upper_dir.empty() &&
+            (syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, "upperdir", upper_dir.c_str(), 0) != 0 ||
+             syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, "workdir", work_dir.c_str(), 0) != 0)) {
+            return -1;
+        }
+        
+        std::stringstream list(options);
+        std::string option;
+        while (std::getline(list, option, ',')) {
+            if (option.empty()) continue;
+            size_t equals = option.find('=');
+            int result = equals == std::string::npos
+                ? syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_FLAG, option.c_str(), nullptr, 0)
+                : syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, option.substr(0, equals).c_str(),
+                          option.substr(equals + 1).c_str(), 0);
+            if (result != 0) return -1;
+        }
+        
+        return syscall(SYS_fsconfig, fs_fd, FSCONFIG_CMD_CREATE, nullptr, nullptr, 0) == 0 ? 0 : -1;
+    }
+    
+    // The kernel explains fsconfig failures through the fs context fd
+    static void print_fs_log(int fs_fd) {
+        char message[512];
+        ssize_t length;
+        while ((length = read(fs_fd, message, sizeof(message) - 1)) > 0) {
+            message[length] = '\0';
+            std::cerr << "[OVERLAY] " << message << std::endl;
+        }
+    }
+    
+    // "dir:dir" as mount(2) takes lowerdir, with colons in paths (alpine:latest) escaped
+    static std::string join_lower_dirs(const std::vector<std::string>& lower_dirs) {
+        std::string joined;
+        for (const auto& dir : lower_dirs) {
+            if (!joined.empty()) joined += ":";
+            for (char c : dir) {
+                if (c == ':' || c == '\\') joined += '\\';
+                joined += c;
+            }
+        }
+        return joined;
+    }
+    
+    static std::vector<std::string> split_lower_dirs(const std::string& joined) {
+        std::vector<std::string> lower_dirs(1);
+        for (size_t i = 0; i < joined.size(); i++) {
+            if (joined[i] == '\\' && i + 1 < joined.size()) {
+                lower_dirs.back() += joined[++i];
+            } else if (joined[i] == ':') {
+                lower_dirs.emplace_back();
+            } else {
+                lower_dirs.back() += joined[i];
+            }
+        }
+        return lower_dirs;
+    }
+    
+    // Read-only root: a bind mount of a single layer, or an overlay without
+    // an upper dir when there are several
+    static int mount_lower_dirs(const std::vector<std::string>& lower_dirs, const std::string& merged_dir,
+                                bool userxattr) {
+        if (lower_dirs.size() == 1) {
+            return mount_read_only(lower_dirs[0], merged_dir);
+        }
+        
+        std::cout << "[OVERLAY] Mounting " << lower_dirs.size() << " layers read-only" << std::endl;
+        if (mount_overlay(lower_dirs, "", "", userxattr ? ",userxattr" : "", merged_dir) != 0) {
+            perror("Failed to mount image layers");
+            return -1;
+        }
+        return 0;
+    }
+    
+    static bool kernel_at_least(int major_version, int minor_version) {
+        struct utsname uts;
+        int major = 0, minor = 0;
+        if (uname(&uts) != 0 || sscanf(uts.release, "%d.%d", &major, &minor) != 2) return false;
+        return major > major_version || (major == major_version && minor >= minor_version);
+    }
+    
+    static int mount_read_only(const std::string& lower_dir, const std::string& merged_dir) {
+        std::cout << "[OVERLAY] Mounting " << lower_dir << " read-only" << std::endl;
+        if (::mount(lower_dir.c_str(), merged_dir.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
+            perror("Failed to bind mount rootfs");
+            return -1;
+        }
+        return remount_read_only(merged_dir);
+    }
+    
+    int cleanup(const std::string& container_id) override {
+        std::string container_overlay = overlay_dir + "/" + container_id;
+        std::string merged_dir = container_overlay + "/merged";
+        
+        // Unmount if it was mounted with OverlayFS
+        if (std::filesystem::exists(merged_dir)) {
+            if (umount(merged_dir.c_str()) != 0) {
+                // It's OK if this fails - might not be mounted or might be a copy
+            }
+        }
+        
+        // Remove the entire container overlay directory
+        try {
+            std::filesystem::remove_all(container_overlay);
+        } catch (const std::exception& e) {
+            // Rootless: overlay's work dir and files of subordinate IDs need the container's maps
+            if (!UserNamespace::rootless() || UserNamespace::remove_with_id_maps(container_overlay) != 0) {
+                std::cout << "[CLEANUP] Note: " << e.what() << std::endl;
+            }
+        }
+        return 0;
+    }
+};
+
+// Defined with the container registry, below
+bool snapshot_base_in_use(const std::string& base);
+
+// Drivers that give every container a full private tree, cloned from a
+// flattened copy of its image. The flattened copy is built once per layer
+// stack under <storage>/<driver>/images; how cheaply a container's clone is
+// made (snapshot, reflinks, plain copy) is what the drivers differ in.
+class SnapshotDriver : public StorageDriver {
+protected:
+    std::string driver_dir;
+    std::string cloned_from;
+    
+    explicit SnapshotDriver(const std::string& driver_name)
+        : driver_dir(iza_storage_root() + "/" + driver_name) {
+        std::filesystem::create_directories(driver_dir + "/images");
+        std::filesystem::create_directories(driver_dir + "/containers");
+    }
+    
+    // An empty tree at PATH, to be filled with the image
+    virtual int create_tree(const std::string& path) {
+        return mkdir(path.c_str(), 0755) == 0 ? 0 : -1;
+    }
+    virtual int clone_tree(const std::string& source, const std::string& target) = 0;
+    virtual int remove_tree(const std::string& path) {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+        if (ec && UserNamespace::rootless()) {
+            // Files of subordinate IDs need the container's maps
+            return UserNamespace::remove_with_id_maps(path);
+        }
+        return ec ? -1 : 0;
+    }
+    virtual bool use_reflinks() const {
+        return false;
+    }
+    
+public:
+    int prepare(const std::vector<std::string>& lower_dirs, const std::string& container_id,
+                std::string& rootfs, bool read_only) override {
+        (void)read_only;                // Applied by mount, inside the container
+        std::string base = base_tree(lower_dirs);
+        if (base.empty()) {
+            return -1;
+        }
+        cloned_from = base;
+        
+        cleanup(container_id);
+        rootfs = driver_dir + "/containers/" + container_id;
+        
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (clone_tree(base, rootfs) != 0) {
+            std::cerr << "[STORAGE] Failed to clone " << base << " for " << name() << std::endl;
+            remove_tree(rootfs);
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+        std::cout << "[STORAGE] " << name() << ": rootfs ready in " << ms << "ms at " << rootfs << std::endl;
+        return 0;
+    }
+    
+    int mount(const std::string& rootfs, bool read_only) override {
+        if (!read_only) return 0;
+        if (::mount(rootfs.c_str(), rootfs.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
+            perror("Failed to bind mount rootfs");
+            return -1;
+        }
+        return remount_read_only(rootfs);
+    }
+    
+    std::string base() const override {
+        return cloned_from;
+    }
+    
+    // No upper dir to read: compare the whole tree against the flattened
+    // image it was cloned from, which may no longer be the image's latest
+    int diff(const std::string& rootfs, const std::vector<std::string>& lower_dirs, const std::string& base,
+             std::vector<std::pair<std::string, char>>& changes) override {
+        (void)lower_dirs;
+        if (base.empty() || !std::filesystem::exists(base)) {
+            std::cerr << "Error: The image tree " << rootfs << " was cloned from is not recorded or is gone" << std::endl;
+            return -1;
+        }
+        int result = compare_trees(base, rootfs, "", changes);
+        std::sort(changes.begin(), changes.end());
+        return result;
+    }
+    
+    int cleanup(const std::string& container_id) override {
+        std::string rootfs = driver_dir + "/containers/" + container_id;
+        if (!std::filesystem::exists(rootfs)) return 0;
+        if (remove_tree(rootfs) != 0) {
+            std::cout << "[CLEANUP] Note: could not remove " << rootfs << std::endl;
+        }
+        return 0;
+    }
+    
+    // Copies SOURCE's entries into TARGET with owners, modes, timestamps,
+    // xattrs and hard links. SOURCE may be an overlay layer: its whiteouts
+    // delete from TARGET and its opaque directories replace what TARGET had.
+    static int copy_layer(const std::string& source, const std::string& target, bool reflink) {
+        std::map<std::pair<dev_t, ino_t>, std::string> links;
+        return copy_layer(source, target, reflink, links);
+    }
+    
+    // LINKS maps each multiply-linked source inode to its first copy
+    static int copy_layer(const std::string& source, const std::string& target, bool reflink,
+                          std::map<std::pair<dev_t, ino_t>, std::string>& links) {
+        std::vector<std::string> names;
+        try {
+            for (const auto& entry : std::filesystem::directory_iterator(source)) {
+                names.push_back(entry.path().filename().string());
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "[STORAGE] Failed to read " << source << ": " << e.what() << std::endl;
+            return -1;
+        }
+        
+        for (const auto& name : names) {
+            std::string from = source + "/" + name;
+            std::string to = target + "/" + name;
+            struct stat st, existing;
+            if (lstat(from.c_str(), &st) != 0) {
+                perror(("Failed to stat " + from).c_str());
+                return -1;
+            }
+            bool exists = lstat(to.c_str(), &existing) == 0;
+            
+            std::error_code ec;
+            if (S_ISCHR(st.st_mode) && st.st_rdev == makedev(0, 0)) {
+                std::filesystem::remove_all(to, ec);
+                continue;
+            }
+            if (exists && (!S_ISDIR(st.st_mode) || !S_ISDIR(existing.st_mode) || is_opaque(from))) {
+                std::filesystem::remove_all(to, ec);
+                exists = false;
+            }
+            
+            int result = 0;
+            if (S_ISDIR(st.st_mode)) {
+                if (!exists && mkdir(to.c_str(), 0700) != 0) result = -1;
+                if (result == 0) result = copy_layer(from, to, reflink, links);
+            } else if (S_ISREG(st.st_mode)) {
+                if (st.st_nlink > 1) {
+                    auto [link, first] = links.try_emplace({st.st_dev, st.st_ino}, to);
+                    // A later layer may have removed the first copy since
+                    if (!first && ::link(link->second.c_str(), to.c_str()) == 0) continue;
+                    link->second = to;
+                }
+                result = copy_file(from, to, reflink);
+            } else if (S_ISLNK(st.st_mode)) {
+                char link[PATH_MAX];
+                ssize_t len = readlink(from.c_str(), link, sizeof(link) - 1);
+                if (len >= 0) link[len] = '\0';
+                result = len >= 0 && symlink(link, to.c_str()) == 0 ? 0 : -1;
+            } else {
+                result = mknod(to.c_str(), st.st_mode, st.st_rdev);
+            }
+            
+            if (result != 0 || copy_metadata(from, to, st) != 0) {
+                perror(("Failed to copy " + from).c_str());
+                return -1;
+            }
+        }
+        return 0;
+    }
+    
+    static int copy_metadata(const std::string& from, const std::string& path, const struct stat& st) {
+        // Only root may give files away; rootless trees keep the caller's IDs
+        if (lchown(path.c_str(), st.st_uid, st.st_gid) != 0 && geteuid() == 0) return -1;
+        if (!S_ISLNK(st.st_mode) && chmod(path.c_str(), st.st_mode & 07777) != 0) return -1;
+        // After chown, which clears security.capability
+        if (copy_xattrs(from, path) != 0) return -1;
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        return utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW);
+    }
+    
+    // All xattrs but overlay's own. Namespaces the caller may not write
+    // (trusted.* and file capabilities when rootless) are skipped.
+    static int copy_xattrs(const std::string& from, const std::string& to) {
+        ssize_t size = llistxattr(from.c_str(), nullptr, 0);
+        if (size <= 0) return size < 0 && errno != ENOTSUP ? -1 : 0;
+        std::string names(size, '\0');
+        size = llistxattr(from.c_str(), &names[0], names.size());
+        if (size < 0) return -1;
+        
+        for (size_t pos = 0; pos < (size_t)size; pos += strlen(names.c_str() + pos) + 1) {
+            const char* name = names.c_str() + pos;
+            if (strncmp(name, "trusted.overlay.", 16) == 0 || strncmp(name, "user.overlay.", 13) == 0) continue;
+            ssize_t len = lgetxattr(from.c_str(), name, nullptr, 0);
+            if (len < 0) return -1;
+            std::string value(len, '\0');
+            len = lgetxattr(from.c_str(), name, &value[0], value.size());
+            if (len < 0) return -1;
+            if (lsetxattr(to.c_str(), name, value.data(), len, 0) != 0 &&
+                errno != EPERM && errno != ENOTSUP && errno != EACCES) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    
+    // A reflink shares the source's extents (XFS, btrfs); otherwise
+    // copy_file_range lets the filesystem copy without a round trip through us
+    static int copy_file(const std::string& from, const std::string& to, bool reflink) {
+        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) return -1;
+        int out = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (out < 0) {
+            close(in);
+            return -1;
+        }
+        
+        int result = 0;
+        if (!reflink || ioctl(out, FICLONE, in) != 0) {
+            ssize_t n;
+            while ((n = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0)) > 0) {}
+            if (n < 0) {
+                // Not supported across these filesystems: plain read/write
+                char buf[65536];
+                lseek(in, 0, SEEK_SET);
+                lseek(out, 0, SEEK_SET);
+                while ((n = read(in, buf, sizeof(buf))) > 0) {
+                    if (write(out, buf, n) != n) {
+                        n = -1;
+                        break;
+                    }
+                }
+            }
+            result = n < 0 ? -1 : 0;
+        }
+        close(in);
+        close(out);
+        return result;
+    }
+    
+    static bool is_opaque(const std::string& path) {
+        char value[2];
+        for (const char* name : {"trusted.overlay.opaque", "user.overlay.opaque"}) {
+            if (lgetxattr(path.c_str(), name, value, sizeof(value)) == 1 && value[0] == 'y') return true;
+        }
+        return false;
+    }
+    
+private:
+    // The image's layers applied bottom-up into one tree, keyed by the
+    // layers' contents so a re-pulled image gets a fresh copy. The tree it
+    // replaces, built from the same layer dirs, is removed then.
+    std::string base_tree(const std::vector<std::string>& lower_dirs) {
+        Sha256 hash;
+        std::string sources;
+        for (const auto& dir : lower_dirs) {
+            std::string identity = layer_identity(dir);
+            if (identity.empty()) {
+                return "";
+            }
+            hash.update(identity + "\n");
+            sources += dir + "\n";
+        }
+        std::string digest = hash.hex_digest();
+        std::string base = driver_dir + "/images/" + digest;
+        if (std::filesystem::exists(base)) {
+            return base;
+        }
+        remove_superseded(sources, digest);
+        
+        std::cout << "[STORAGE] " << name() << ": flattening " << lower_dirs.size() << " layer(s) into " << base << std::endl;
+        std::string staging = base + ".tmp-" + std::to_string(getpid());
+        remove_tree(staging);
+        if (create_tree(staging) != 0) {
+            perror(("Failed to create " + staging).c_str());
+            return "";
+        }
+        for (auto layer = lower_dirs.rbegin(); layer != lower_dirs.rend(); ++layer) {
+            if (copy_layer(*layer, staging, use_reflinks()) != 0) {
+                remove_tree(staging);
+                return "";
+            }
+        }
+        
+        struct stat st;
+        if (stat(lower_dirs.back().c_str(), &st) == 0) {
+            copy_metadata(lower_dirs.back(), staging, st);
+        }
+        // Another run may have finished the same image first
+        if (rename(staging.c_str(), base.c_str()) != 0) {
+            remove_tree(staging);
+            if (!std::filesystem::exists(base)) return "";
+        }
+        std::ofstream(base + ".layers") << sources;
+        return base;
+    }
+    
+    // What a layer dir holds: a committed layer's digest, the id a pull
+    // recorded next to an image's rootfs, or failing both the dir's
+    // identity and change time
+    static std::string layer_identity(const std::string& dir) {
+        std::filesystem::path parent = std::filesystem::path(dir).parent_path();
+        std::ifstream id_file(parent / "id");
+        std::string id;
+        if (std::getline(id_file, id) && !id.empty()) {
+            return "image:" + id;
+        }
+        if (std::filesystem::exists(parent / "layer.tar")) {
+            return "sha256:" + parent.filename().string();
+        }
+        
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0) {
+            perror(("Failed to stat layer " + dir).c_str());
+            return "";
+        }
+        return dir + ":" + std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino) + ":" +
+               std::to_string(st.st_ctim.tv_sec) + "." + std::to_string(st.st_ctim.tv_nsec);
+    }
+    
+    // Drops flattened trees of earlier contents of the same layer dirs,
+    // except those running containers were cloned from: "iza diff" needs them
+    void remove_superseded(const std::string& sources, const std::string& digest) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(driver_dir + "/images", ec)) {
+            std::string path = entry.path().string();
+            if (!path.ends_with(".layers") || entry.path().stem() == digest) continue;
+            
+            std::ifstream in(path);
+            std::string recorded((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (recorded != sources) continue;
+            std::string old_base = path.substr(0, path.size() - 7);
+            if (snapshot_base_in_use(old_base)) continue;
+            std::cout << "[STORAGE] " << name() << ": removing superseded " << old_base << std::endl;
+            if (remove_tree(old_base) == 0) {
+                std::filesystem::remove(path, ec);
+            }
+        }
+    }
+    
+    static int compare_trees(const std::string& base, const std::string& rootfs, const std::string& dir,
+                             std::vector<std::pair<std::string, char>>& changes) {
+        std::set<std::string> base_names, names;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(base + "/" + dir, ec)) {
+            base_names.insert(entry.path().filename().string());
+        }
+        for (const auto& entry : std::filesystem::directory_iterator(rootfs + "/" + dir, ec)) {
+            names.insert(entry.path().filename().string());
+        }
+        if (ec) {
+            std::cerr << "Failed to read " << rootfs << "/" << dir << ": " << ec.message() << std::endl;
+            return -1;
+        }
+        
+        for (const auto& name : base_names) {
+            if (!names.count(name)) changes.push_back({"/" + dir + name, 'D'});
+        }
+        for (const auto& name : names) {
+            std::string path = dir + name;
+            struct stat st, old;
+            if (lstat((rootfs + "/" + path).c_str(), &st) != 0) continue;
+            
+            bool added = !base_names.count(name) || lstat((base + "/" + path).c_str(), &old) != 0;
+            if (added) {
+                changes.push_back({"/" + path, 'A'});
+            } else if (st.st_mode != old.st_mode || st.st_uid != old.st_uid || st.st_gid != old.st_gid ||
+                       st.st_size != old.st_size || st.st_rdev != old.st_rdev ||
+                       st.st_mtim.tv_sec != old.st_mtim.tv_sec || st.st_mtim.tv_nsec != old.st_mtim.tv_nsec) {
+                changes.push_back({"/" + path, 'C'});
+            }
+            
+            if (S_ISDIR(st.st_mode)) {
+                // Below an added directory everything is added
+                if (added) {
+                    for (const auto& entry : std::filesystem::recursive_directory_iterator(rootfs + "/" + path, ec)) {
+                        changes.push_back({"/" + path + "/" + entry.path().lexically_relative(rootfs + "/" + path).string(), 'A'});
+                    }
+                } else if (compare_trees(base, rootfs, path + "/", changes) != 0) {
+                    return -1;
+                }
+            }
+        }
+        return 0;
+    }
+};
+
+// Each container's root is a btrfs snapshot of the image's subvolume:
+// constant time and no data written, whatever the image size
+class BtrfsDriver : public SnapshotDriver {
+public:
+    BtrfsDriver() : SnapshotDriver("btrfs") {}
+    
+    std::string name() const override {
+        return "btrfs";
+    }
+    
+protected:
+    int create_tree(const std::string& path) override {
+        struct btrfs_ioctl_vol_args args = {};
+        return subvolume_ioctl(path, BTRFS_IOC_SUBVOL_CREATE, args);
+    }
+    
+    int clone_tree(const std::string& source, const std::string& target) override {
+        int source_fd = open(source.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (source_fd < 0) return -1;
+        
+        struct btrfs_ioctl_vol_args_v2 args = {};
+        args.fd = source_fd;
+        int result = subvolume_ioctl(target, BTRFS_IOC_SNAP_CREATE_V2, args);
+        close(source_fd);
+        return result;
+    }
+    
+    // Unprivileged users can't destroy snapshots unless the filesystem is
+    // mounted with user_subvol_rm_allowed, but may rmdir empty ones (4.18+)
+    int remove_tree(const std::string& path) override {
+        if (!std::filesystem::exists(path)) return 0;
+        struct btrfs_ioctl_vol_args args = {};
+        if (subvolume_ioctl(path, BTRFS_IOC_SNAP_DESTROY, args) == 0) return 0;
+        return SnapshotDriver::remove_tree(path);
+    }
+    
+    bool use_reflinks() const override {
+        return true;
+    }
+    
+private:
+    // The subvolume ioctls take the parent directory and the new entry's name
+    template <typename Args>
+    static int subvolume_ioctl(const std::string& path, unsigned long request, Args& args) {
+        std::filesystem::path target(path);
+        std::string name = target.filename().string();
+        if (name.size() >= sizeof(args.name)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(args.name, name.c_str(), name.size() + 1);
+        
+        int parent_fd = open(target.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (parent_fd < 0) return -1;
+        int result = ioctl(parent_fd, request, &args);
+        int saved_errno = errno;
+        close(parent_fd);
+        errno = saved_errno;
+        return result == 0 ? 0 : -1;
+    }
+};
+
+// Each container's root is a tree of reflinks (XFS with reflink=1, btrfs):
+// metadata is written per file, data is shared until modified
+class ReflinkDriver : public SnapshotDriver {
+public:
+    ReflinkDriver() : SnapshotDriver("reflink") {}
+    
+    std::string name() const override {
+        return "reflink";
+    }
+    
+protected:
+    int clone_tree(const std::string& source, const std::string& target) override {
+        return create_tree(target) == 0 && copy_layer(source, target, true) == 0 ? 0 : -1;
+    }
+    
+    bool use_reflinks() const override {
+        return true;
+    }
+};
+
+// Each container gets a full copy of the image; works everywhere, costs O(bytes)
+class CopyDriver : public SnapshotDriver {
+public:
+    CopyDriver() : SnapshotDriver("copy") {}
+    
+    std::string name() const override {
+        return "copy";
+    }
+    
+protected:
+    int clone_tree(const std::string& source, const std::string& target) override {
+        return create_tree(target) == 0 && copy_layer(source, target, false) == 0 ? 0 : -1;
+    }
+};
+
+// Whether files under DIR can share extents, tried on two scratch files
+bool reflink_supported(const std::string& dir) {
+    std::string probe = dir + "/.reflink-probe-" + std::to_string(getpid());
+    int in = open(probe.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    int out = open((probe + ".clone").c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool supported = in >= 0 && out >= 0 && write(in, "iza", 3) == 3 && ioctl(out, FICLONE, in) == 0;
+    if (in >= 0) close(in);
+    if (out >= 0) close(out);
+    unlink(probe.c_str());
+    unlink((probe + ".clone").c_str());
+    return supported;
+}
+
+// NAME is overlay, btrfs, reflink or copy; "auto" or empty picks by the
+// filesystem behind the storage root: btrfs snapshots on btrfs, then
+// overlay, then reflinks where the filesystem has them, then copying
+std::unique_ptr<StorageDriver> make_storage_driver(const std::string& name, const std::string& overlay_opts = "") {
+    std::string chosen = name;
+    if (chosen.empty() || chosen == "auto") {
+        std::string root = iza_storage_root();
+        std::filesystem::create_directories(root);
+        
+        struct statfs fs;
+        if (statfs(root.c_str(), &fs) == 0 && fs.f_type == BTRFS_SUPER_MAGIC) {
+            chosen = "btrfs";
+        } else if (OverlayFS().available()) {
+            chosen = "overlay";
+        } else if (reflink_supported(root)) {
+            chosen = "reflink";
+        } else {
+            chosen = "copy";
+        }
+    }
+    
+    if (chosen == "overlay") {
+        auto overlay = std::make_unique<OverlayFS>();
+        overlay->set_options(overlay_opts);
+        return overlay;
+    }
+    if (chosen == "btrfs") return std::make_unique<BtrfsDriver>();
+    if (chosen == "reflink") return std::make_unique<ReflinkDriver>();
+    return std::make_unique<CopyDriver>();
+}
+
+class CgroupManager {
+private:
+    std::string cgroup_name;
+    std::string cgroup_path;
+    std::string parent_path;
+    bool created = false;
+    bool owned = true;                  // False when attached to an existing cgroup
+    
+    static inline const std::string cgroup_root = "/sys/fs/cgroup";
+    static inline const std::vector<std::string> wanted_controllers = {"cpuset", "cpu", "io", "memory", "pids"};
+    
+public:
+    CgroupManager() {
+        // Generate unique cgroup name
+        cgroup_name = "iza-" + std::to_string(getpid()) + "-" + std::to_string(time(nullptr));
+        set_parent("");
+    }
+    
+    // Operate on a cgroup someone else created (a running container, the slice)
+    explicit CgroupManager(const std::string& existing_path) {
+        cgroup_path = existing_path;
+        cgroup_name = std::filesystem::path(existing_path).filename().string();
+        created = std::filesystem::exists(existing_path);
+        owned = false;
+    }
+    
+    ~CgroupManager() {
+        cleanup();
+    }
+    
+    static bool available() {
+        return std::filesystem::exists(cgroup_root + "/cgroup.controllers");
+    }
+    
+    // Parent cgroup for all iza containers: an explicit path, IZA_CGROUP_PARENT,
+    // or iza.slice at the top of the hierarchy we are allowed to manage
+    static std::string resolve_parent(const std::string& requested) {
+        std::string parent = requested;
+        if (parent.empty()) {
+            char* env_parent = getenv("IZA_CGROUP_PARENT");
+            if (env_parent != nullptr) parent = env_parent;
+        }
+        
+        if (!parent.empty()) {
+            return parent.starts_with(cgroup_root) ? parent : cgroup_root + "/" + parent;
+        }
+        
+        if (access((cgroup_root + "/cgroup.subtree_control").c_str(), W_OK) == 0) {
+            return cgroup_root + "/iza.slice";
+        }
+        
+        // Without access to the root, use the topmost ancestor of our own cgroup
+        // that was delegated to us (e.g. systemd's user@UID.service)
+        std::string delegated = delegation_root();
+        if (!delegated.empty()) {
+            return delegated + "/iza.slice";
+        }
+        return cgroup_root + "/iza.slice";
+    }
+    
+    void set_parent(const std::string& requested) {
+        parent_path = resolve_parent(requested);
+        cgroup_path = parent_path + "/" + cgroup_name;
+    }
+    
+    const std::string& parent() const {
+        return parent_path;
+    }
+    
+    const std::string& path() const {
+        return cgroup_path;
+    }
+    
+    bool is_created() const {
+        return created;
+    }
+    
+    // Directory fd of the cgroup, as perf_event_open() wants for cgroup mode
+    int open_dir() const {
+        int fd = open(cgroup_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            perror(("Failed to open cgroup " + cgroup_path).c_str());
+        }
+        return fd;
+    }
+    
+    // Creates the parent slice and enables controllers on every level from the
+    // hierarchy root down to it. Cheap once done: the slice is left in place.
+    static int ensure_slice(const std::string& parent_path) {
+        if (has_controllers(parent_path, wanted_controllers)) {
+            return 0;
+        }
+        
+        std::error_code ec;
+        std::filesystem::create_directories(parent_path, ec);
+        if (ec) {
+            std::cerr << "Failed to create " << parent_path << ": " << ec.message() << std::endl;
+            return -1;
+        }
+        
+        // Collect the chain of cgroups below the root, topmost first
+        std::vector<std::string> chain;
+        std::filesystem::path level = parent_path;
+        while (level.string().size() > cgroup_root.size()) {
+            level = level.parent_path();
+            chain.insert(chain.begin(), level.string());
+        }
+        chain.push_back(parent_path);
+        
+        std::vector<std::string> missing;
+        for (size_t i = 0; i < chain.size(); i++) {
+            // Rootless: levels above the delegation are the delegator's to set up;
+            // what they left enabled shows in the check below
+            if (access((chain[i] + "/cgroup.subtree_control").c_str(), W_OK) != 0) continue;
+            
+            // Each level has to enable a controller for its children to get it
+            for (const auto& controller : wanted_controllers) {
+                if (has_controllers(chain[i], {controller})) continue;
+                if (!list_contains(read_first_line(chain[i] + "/cgroup.controllers"), controller)) continue;
+                
+                std::ofstream subtree(chain[i] + "/cgroup.subtree_control");
+                subtree << "+" << controller;
+                subtree.close();
+                if (subtree.fail() && std::find(missing.begin(), missing.end(), controller) == missing.end()) {
+                    missing.push_back(controller);
+                }
+            }
+        }
+        
+        std::string available_controllers = read_first_line(parent_path + "/cgroup.subtree_control");
+        for (const auto& controller : wanted_controllers) {
+            if (!list_contains(available_controllers, controller) &&
+                std::find(missing.begin(), missing.end(), controller) == missing.end()) {
+                missing.push_back(controller);
+            }
+        }
+        
+        if (!missing.empty()) {
+            std::cout << "[CGROUP] Warning: controller(s) not available under " << parent_path << ":";
+            for (const auto& controller : missing) std::cout << " " << controller;
+            std::cout << " (limits for them will fail)" << std::endl;
+        }
+        return 0;
+    }
+    
+    int create_cgroup() {
+        std::cout << "[CGROUP] Creating: " << cgroup_path << std::endl;
+        
+        // Check if cgroups v2 is available
+        if (!available()) {
+            std::cerr << "Error: cgroups v2 not available" << std::endl;
+            return -1;
+        }
+        
+        if (ensure_slice(parent_path) != 0) {
+            if (UserNamespace::rootless()) {
+                std::cerr << "Rootless: no writable delegated cgroup; run under 'systemd-run --user --scope -p Delegate=yes'"
+                          << " or set IZA_CGROUP_PARENT" << std::endl;
+            }
+            return -1;
+        }
+        
+        // Create cgroup directory
+        if (mkdir(cgroup_path.c_str(), 0755) != 0) {
+            perror("Failed to create cgroup directory");
+            return -1;
+        }
+        
+        created = true;
+        return 0;
+    }
+    
+    // cgroup.freeze (Linux 5.2+); returns once cgroup.events reports the new state
+    int set_frozen(bool frozen, int timeout_ms = 5000) {
+        if (!created) return -1;
+        
+        std::string value = frozen ? "1" : "0";
+        if (write_control("cgroup.freeze", value) != 0) return -1;
+        
+        if (wait_for_event(cgroup_path, "frozen", value, timeout_ms) != 0) {
+            std::cerr << "Timed out waiting for " << cgroup_path << " to "
+                      << (frozen ? "freeze" : "thaw") << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    
+    // Ask the kernel to reclaim BYTES from the cgroup (Linux 5.19+). Fails with
+    // EAGAIN when less than that could be reclaimed; errno is left for the caller.
+    int reclaim_memory(long long bytes) {
+        if (!created) return -1;
+        
+        int fd = open((cgroup_path + "/memory.reclaim").c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0) return -1;
+        
+        std::string value = std::to_string(bytes);
+        ssize_t n = write(fd, value.c_str(), value.size());
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return n < 0 ? -1 : 0;
+    }
+    
+    // SIGKILL everything in the cgroup; frozen tasks die too
+    void kill_processes() {
+        if (created) kill_all(cgroup_path);
+    }
+    
+    // Numeric value of a single-value interface file; -1 for "max" or unreadable
+    long long read_value(const std::string& file) {
+        std::string value = read_first_line(cgroup_path + "/" + file);
+        if (value.empty() || value == "max") return -1;
+        try {
+            return std::stoll(value);
+        } catch (const std::exception& e) {
+            return -1;
+        }
+    }
+    
+    long long limit_bytes(const std::string& limit) {
+        return parse_memory_limit(limit);
+    }
+    
+    // Current contents of interface files, to roll back a multi-file update
+    std::map<std::string, std::string> snapshot(const std::vector<std::string>& files) {
+        std::map<std::string, std::string> saved;
+        for (const auto& file : files) {
+            std::ifstream in(cgroup_path + "/" + file);
+            if (!in.is_open()) continue;
+            std::stringstream content;
+            content << in.rdbuf();
+            saved[file] = content.str();
+        }
+        return saved;
+    }
+    
+    void restore(const std::map<std::string, std::string>& saved) {
+        for (const auto& [file, content] : saved) {
+            if (file != "io.max" && file != "io.weight") {
+                write_control(file, content.substr(0, content.find('\n')));
+                continue;
+            }
+            
+            // Per-device files take one line per write; devices that only
+            // appear in the new contents get reset to the defaults
+            std::map<std::string, std::string> old_lines = device_lines(content);
+            std::ifstream in(cgroup_path + "/" + file);
+            std::stringstream current;
+            current << in.rdbuf();
+            for (const auto& [device, line] : device_lines(current.str())) {
+                if (old_lines.count(device)) continue;
+                write_control(file, file == "io.max" ?
+                              device + " rbps=max wbps=max riops=max wiops=max" : device + " default");
+            }
+            for (const auto& [device, line] : old_lines) {
+                write_control(file, line);
+            }
+        }
+    }
+    
+    // Enabled controllers and current limits, for "iza slice"
+    void print_summary() {
+        std::cout << "Cgroup:      " << cgroup_path << std::endl;
+        std::cout << "Controllers: " << read_first_line(cgroup_path + "/cgroup.subtree_control") << std::endl;
+        
+        for (const char* file : {"memory.current", "memory.max", "memory.high", "cpu.max", "cpu.weight",
+                                 "pids.current", "pids.max", "cpuset.cpus", "cpuset.mems", "io.max"}) {
+            std::string value = read_first_line(cgroup_path + "/" + file);
+            if (!value.empty()) {
+                printf("  %-16s %s\n", file, value.c_str());
+            }
+        }
+    }
+    
+    int set_memory_limit(const std::string& limit) {
+        if (!created) return -1;
+        
+        // A zero memory.max would OOM the container at once
+        if (limit != "max" && parse_memory_limit(limit) <= 0) {
+            std::cerr << "Invalid memory limit '" << limit << "'" << std::endl;
+            return -1;
+        }
+        return set_memory_control("memory.max", "Memory limit", limit);
+    }
+    
+    int set_cpu_limit(const std::string& limit, int period = 100000) {
+        if (!created) return -1;
+        
+        double cpu_cores;
+        try {
+            cpu_cores = std::stod(limit);
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid CPU limit '" << limit << "'" << std::endl;
+            return -1;
+        }
+        if (cpu_cores <= 0) return -1;
+        
+        int quota = (int)(cpu_cores * period);
+        if (set_cpu_max(quota, period) != 0) return -1;
+        
+        std::cout << "[CGROUP] CPU limit: " << limit << " cores" << std::endl;
+        return 0;
+    }
+    
+    // Raw cpu.max: quota and period in microseconds
+    int set_cpu_max(long quota_us, long period_us) {
+        if (!created) return -1;
+        return write_control("cpu.max", std::to_string(quota_us) + " " + std::to_string(period_us));
+    }
+    
+    // Quota a task may carry over from quiet periods (Linux 5.14+)
+    int set_cpu_burst(long burst_us) {
+        if (!created) return -1;
+        if (!std::filesystem::exists(cgroup_path + "/cpu.max.burst")) {
+            errno = ENOENT;
+            return -1;
+        }
+        return write_control("cpu.max.burst", std::to_string(burst_us));
+    }
+    
+    int set_memory_high(const std::string& limit) {
+        return set_memory_control("memory.high", "Memory high", limit);
+    }
+    
+    int set_memory_low(const std::string& limit) {
+        return set_memory_control("memory.low", "Memory low", limit);
+    }
+    
+    int set_memory_min(const std::string& limit) {
+        return set_memory_control("memory.min", "Memory min", limit);
+    }
+    
+    int set_swap_limit(const std::string& limit) {
+        return set_memory_control("memory.swap.max", "Swap limit", limit);
+    }
+    
+    int set_cpu_weight(const std::string& weight) {
+        if (!created) return -1;
+        
+        long long value = parse_number(weight);
+        if (value < 1 || value > 10000) {
+            std::cerr << "Invalid CPU weight '" << weight << "' (expected 1-10000)" << std::endl;
+            return -1;
+        }
+        
+        if (write_control("cpu.weight", std::to_string(value)) != 0) return -1;
+        
+        std::cout << "[CGROUP] CPU weight: " << value << std::endl;
+        return 0;
+    }
+    
+    int set_pids_limit(const std::string& limit) {
+        if (!created) return -1;
+        
+        if (limit != "max" && parse_number(limit) <= 0) {
+            std::cerr << "Invalid pids limit '" << limit << "'" << std::endl;
+            return -1;
+        }
+        
+        if (write_control("pids.max", limit) != 0) return -1;
+        
+        std::cout << "[CGROUP] PIDs limit: " << limit << std::endl;
+        return 0;
+    }
+    
+    int set_cpuset(const std::string& cpus, const std::string& mems) {
+        if (!created) return -1;
+        
+        if (!cpus.empty()) {
+            if (write_control("cpuset.cpus", cpus) != 0) return -1;
+            std::cout << "[CGROUP] CPU set: " << cpus << std::endl;
+        }
+        if (!mems.empty()) {
+            if (write_control("cpuset.mems", mems) != 0) return -1;
+            std::cout << "[CGROUP] Memory nodes: " << mems << std::endl;
+        }
+        return 0;
+    }
+    
+    // spec: DEVICE:key=value[,key=value...] with keys rbps, wbps, riops, wiops
+    int set_io_max(const std::string& spec) {
+        if (!created) return -1;
+        
+        std::string device, limits;
+        if (split_device_spec(spec, device, limits) != 0 || limits.empty()) {
+            std::cerr << "Invalid --io-max '" << spec << "' (expected DEVICE:rbps=N,wbps=N,riops=N,wiops=N)" << std::endl;
+            return -1;
+        }
+        
+        std::string line = device;
+        std::stringstream ss(limits);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            size_t eq = item.find('=');
+            std::string key = item.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : item.substr(eq + 1);
+            
+            if (key != "rbps" && key != "wbps" && key != "riops" && key != "wiops") {
+                std::cerr << "Unknown io.max key '" << key << "'" << std::endl;
+                return -1;
+            }
+            
+            if (value != "max") {
+                // Bandwidth accepts size suffixes, IOPS are plain counts
+                long long n = key.ends_with("bps") ? parse_memory_limit(value) : parse_number(value);
+                if (n <= 0) {
+                    std::cerr << "Invalid io.max value '" << item << "'" << std::endl;
+                    return -1;
+                }
+                value = std::to_string(n);
+            }
+            line += " " + key + "=" + value;
+        }
+        
+        if (write_control("io.max", line) != 0) return -1;
+        
+        std::cout << "[CGROUP] IO max: " << line << std::endl;
+        return 0;
+    }
+    
+    // spec: WEIGHT for the default weight, or DEVICE:WEIGHT for one device
+    int set_io_weight(const std::string& spec) {
+        if (!created) return -1;
+        
+        std::string device = "default";
+        std::string weight = spec;
+        if (spec.find(':') != std::string::npos &&
+            split_device_spec(spec, device, weight) != 0) {
+            std::cerr << "Invalid --io-weight '" << spec << "'" << std::endl;
+            return -1;
+        }
+        
+        long long value = parse_number(weight);
+        if (value < 1 || value > 10000) {
+            std::cerr << "Invalid IO weight '" << weight << "' (expected 1-10000)" << std::endl;
+            return -1;
+        }
+        
+        std::string line = device + " " + std::to_string(value);
+        if (write_control("io.weight", line) != 0) return -1;
+        
+        std::cout << "[CGROUP] IO weight: " << line << std::endl;
+        return 0;
+    }
+    
+    int add_process(pid_t pid) {
+        if (!created) return -1;
+        
+        std::string procs_file = cgroup_path + "/cgroup.procs";
+        std::ofstream procs(procs_file);
+        if (!procs.is_open()) {
+            perror("Failed to add process to cgroup");
+            return -1;
+        }
+        
+        procs << pid;
+        procs.close();
+        
+        return 0;
+    }
+    
+    void cleanup() {
+        if (!created || !owned) return;
+        
+        if (destroy(cgroup_path) != 0) {
+            std::cerr << "[CGROUP] Warning: could not remove " << cgroup_path << std::endl;
+        }
+        
+        created = false;
+    }
+    
+    // Kills whatever is still running in a cgroup (and below it), waits for the
+    // kernel to report it unpopulated, then removes the whole subtree
+    static int destroy(const std::string& path, int timeout_ms = 5000) {
+        // Common case: the container already exited and nothing is left
+        if (rmdir(path.c_str()) == 0 || errno == ENOENT) {
+            return 0;
+        }
+        if (errno != EBUSY) {
+            perror(("Failed to remove cgroup " + path).c_str());
+            return -1;
+        }
+        
+        kill_all(path);
+        
+        // Without cgroup.kill, processes forked while we signalled need another round
+        if (wait_for_event(path, "populated", "0", timeout_ms, [&path]() { kill_all(path); }) != 0) {
+            std::cerr << "[CGROUP] Timed out waiting for " << path << " to empty" << std::endl;
+            return -1;
+        }
+        
+        return remove_tree(path);
+    }
+    
+    // Removes cgroups of containers whose supervisor is gone, both under the
+    // slice and at the top level where older versions created them
+    static int prune(const std::string& slice_path, const std::vector<std::string>& in_use_paths) {
+        int removed = 0;
+        int failed = 0;
+        
+        for (const auto& dir : {slice_path, cgroup_root}) {
+            std::error_code ec;
+            for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+                std::string name = entry.path().filename().string();
+                if (!entry.is_directory() || !name.starts_with("iza-")) continue;
+                
+                bool in_use = std::find(in_use_paths.begin(), in_use_paths.end(),
+                                        entry.path().string()) != in_use_paths.end();
+                
+                // A run that hasn't registered yet still owns its cgroup: iza-<pid>-<time>
+                pid_t owner = 0;
+                try {
+                    owner = std::stoi(name.substr(4));
+                } catch (const std::exception& e) {
+                    owner = 0;
+                }
+                if (in_use || (owner > 0 && kill(owner, 0) == 0)) continue;
+                
+                if (destroy(entry.path().string()) == 0) {
+                    removed++;
+                } else {
+                    failed++;
+                }
+            }
+        }
+        
+        std::cout << "[CGROUP] Removed " << removed << " stale cgroup(s)";
+        if (failed > 0) std::cout << ", " << failed << " could not be removed";
+        std::cout << std::endl;
+        return failed > 0 ? -1 : 0;
+    }
+    
+private:
+    static std::string read_first_line(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+    
+    static bool list_contains(const std::string& list, const std::string& word) {
+        std::stringstream ss(list);
+        std::string item;
+        while (ss >> item) {
+            if (item == word) return true;
+        }
+        return false;
+    }
+    
+    static bool has_controllers(const std::string& path, const std::vector<std::string>& controllers) {
+        std::string enabled = read_first_line(path + "/cgroup.subtree_control");
+        for (const auto& controller : controllers) {
+            if (!list_contains(enabled, controller)) return false;
+        }
+        return std::filesystem::exists(path);
+    }
+    
+    // Topmost cgroup on our own path that we may write to
+    static std::string delegation_root() {
+        std::ifstream self("/proc/self/cgroup");
+        std::string line;
+        std::string own;
+        while (std::getline(self, line)) {
+            if (line.starts_with("0::")) own = line.substr(3);
+        }
+        if (own.empty()) return "";
+        
+        std::string best;
+        std::filesystem::path level = own;
+        while (level.has_relative_path()) {
+            std::string full = cgroup_root + level.string();
+            if (access((full + "/cgroup.subtree_control").c_str(), W_OK) == 0) {
+                best = full;
+            }
+            level = level.parent_path();
+        }
+        return best;
+    }
+    
+    static std::map<std::string, std::string> device_lines(const std::string& content) {
+        std::map<std::string, std::string> lines;
+        std::stringstream ss(content);
+        std::string line;
+        while (std::getline(ss, line)) {
+            if (line.empty()) continue;
+            lines[line.substr(0, line.find(' '))] = line;
+        }
+        return lines;
+    }
+    
+    static std::string event_value(const std::string& path, const std::string& wanted) {
+        std::ifstream events(path + "/cgroup.events");
+        std::string key;
+        std::string value;
+        while (events >> key >> value) {
+            if (key == wanted) return value;
+        }
+        return "";
+    }
+    
+    // Blocks until cgroup.events shows key == value, woken by inotify rather than
+    // sleeping. retry() runs after every wakeup that didn't reach the state yet.
+    static int wait_for_event(const std::string& path, const std::string& key, const std::string& value,
+                              int timeout_ms, std::function<void()> retry = nullptr) {
+        int inotify_fd = inotify_init1(IN_CLOEXEC);
+        std::string events_file = path + "/cgroup.events";
+        if (inotify_fd < 0 || inotify_add_watch(inotify_fd, events_file.c_str(), IN_MODIFY) < 0) {
+            perror("Failed to watch cgroup.events");
+            if (inotify_fd >= 0) close(inotify_fd);
+            return -1;
+        }
+        
+        // Checked only after the watch is armed, so a change in between isn't lost
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = 0;
+        while (event_value(path, key) != value) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+            if (elapsed_ms >= timeout_ms || event_value(path, key).empty()) {
+                result = -1;
+                break;
+            }
+            
+            struct pollfd pfd = {inotify_fd, POLLIN, 0};
+            if (poll(&pfd, 1, timeout_ms - elapsed_ms) > 0) {
+                char buf[4096];
+                if (read(inotify_fd, buf, sizeof(buf)) < 0 && errno != EINTR) {
+                    result = -1;
+                    break;
+                }
+            }
+            
+            if (retry && event_value(path, key) != value) {
+                retry();
+            }
+        }
+        
+        close(inotify_fd);
+        return result;
+    }
+    
+    // cgroup.kill (Linux 5.14+) SIGKILLs the whole subtree atomically
+    static bool kill_via_cgroup_kill(const std::string& path) {
+        int fd = open((path + "/cgroup.kill").c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        bool ok = write(fd, "1", 1) == 1;
+        close(fd);
+        return ok;
+    }
+    
+    static void kill_all(const std::string& path) {
+        if (kill_via_cgroup_kill(path)) return;
+        
+        // Older kernels: signal every process, descendants included
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(path,
+                 std::filesystem::directory_options::skip_permission_denied)) {
+            if (entry.path().filename() != "cgroup.procs") continue;
+            std::ifstream procs(entry.path());
+            pid_t pid;
+            while (procs >> pid) {
+                kill(pid, SIGKILL);
+            }
+        }
+    }
+    
+    // Children first: rmdir only succeeds on cgroups without sub-cgroups
+    static int remove_tree(const std::string& path) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+            if (entry.is_directory()) {
+                remove_tree(entry.path().string());
+            }
+        }
+        if (rmdir(path.c_str()) != 0 && errno != ENOENT) {
+            perror(("Failed to remove cgroup " + path).c_str());
+            return -1;
+        }
+        return 0;
+    }
+    
+    int write_control(const std::string& file, const std::string& value) {
+        std::ofstream out(cgroup_path + "/" + file);
+        if (!out.is_open()) {
+            if (!std::filesystem::exists(cgroup_path + "/" + file)) {
+                // Interface files only exist when the parent enabled the controller
+                std::string controller = file.substr(0, file.find('.'));
+                std::cerr << "Failed to open " << file << ": the " << controller
+                          << " controller is not enabled for " << cgroup_path << std::endl;
+            } else {
+                std::cerr << "Failed to open " << file << ": " << strerror(errno) << std::endl;
+            }
+            return -1;
+        }
+        
+        // cgroupfs validates on write, so errors only show up once the buffer is flushed
+        out << value;
+        out.close();
+        if (out.fail()) {
+            std::cerr << "Failed to write '" << value << "' to " << file << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    
+    int set_memory_control(const std::string& file, const std::string& label, const std::string& limit) {
+        if (!created) return -1;
+        
+        std::string value = limit;
+        if (limit != "max") {
+            long long bytes = parse_memory_limit(limit);
+            if (bytes < 0) {
+                std::cerr << "Invalid " << file << " value '" << limit << "'" << std::endl;
+                return -1;
+            }
+            value = std::to_string(bytes);
+        }
+        
+        if (write_control(file, value) != 0) return -1;
+        
+        std::cout << "[CGROUP] " << label << ": " << limit << " (" << value << ")" << std::endl;
+        return 0;
+    }
+    
+    // Splits "DEVICE:REST" into a "MAJ:MIN" device number and REST.
+    // DEVICE may be a block device path (/dev/sda) or a literal MAJ:MIN.
+    int split_device_spec(const std::string& spec, std::string& device, std::string& rest) {
+        if (spec.starts_with("/")) {
+            size_t colon = spec.find(':');
+            if (colon == std::string::npos) return -1;
+            
+            std::string path = spec.substr(0, colon);
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !S_ISBLK(st.st_mode)) {
+                std::cerr << "Not a block device: " << path << std::endl;
+                return -1;
+            }
+            device = std::to_string(major(st.st_rdev)) + ":" + std::to_string(minor(st.st_rdev));
+            rest = spec.substr(colon + 1);
+            return 0;
+        }
+        
+        size_t first = spec.find(':');
+        size_t second = first == std::string::npos ? std::string::npos : spec.find(':', first + 1);
+        if (second == std::string::npos) return -1;
+        if (parse_number(spec.substr(0, first)) < 0 ||
+            parse_number(spec.substr(first + 1, second - first - 1)) < 0) {
+            return -1;
+        }
+        device = spec.substr(0, second);
+        rest = spec.substr(second + 1);
+        return 0;
+    }
+    
+    long long parse_number(const std::string& value) {
+        if (value.empty() || !std::all_of(value.begin(), value.end(), ::isdigit)) return -1;
+        try {
+            return std::stoll(value);
+        } catch (const std::exception& e) {
+            return -1;
+        }
+    }
+    
+    long long parse_memory_limit(const std::string& limit) {
+        if (limit.empty()) return -1;
+        
+        std::string num_str = limit;
+        char unit = 'b';
+        
+        if (!std::isdigit(limit.back())) {
+            unit = std::tolower(limit.back());
+            num_str = limit.substr(0, limit.length() - 1);
+        }
+        
+        try {
+            long long num = std::stoll(num_str);
+            
+            switch (unit) {
+                case 'b': return num;
+                case 'k': return num * 1024LL;
+                case 'm': return num * 1024LL * 1024LL;
+                case 'g': return num * 1024LL * 1024LL * 1024LL;
+                default: return -1;
+            }
+        } catch (const std::exception& e) {
+            return -1;
+        }
+    }
+};
+
+// Apply every limit requested on the command line, stopping at the first failure
+int apply_resource_limits(CgroupManager& cgroup, const Arguments& args) {
+    if (!args.memory_limit.empty() && cgroup.set_memory_limit(args.memory_limit) != 0) {
+        std::cerr << "Failed to set memory limit" << std::endl;
+        return -1;
+    }
+    if (!args.memory_high.empty() && cgroup.set_memory_high(args.memory_high) != 0) {
+        std::cerr << "Failed to set memory.high" << std::endl;
+        return -1;
+    }
+    if (!args.memory_low.empty() && cgroup.set_memory_low(args.memory_low) != 0) {
+        std::cerr << "Failed to set memory.low" << std::endl;
+        return -1;
+    }
+    if (!args.memory_min.empty() && cgroup.set_memory_min(args.memory_min) != 0) {
+        std::cerr << "Failed to set memory.min" << std::endl;
+        return -1;
+    }
+    if (!args.memory_swap.empty() && cgroup.set_swap_limit(args.memory_swap) != 0) {
+        std::cerr << "Failed to set swap limit" << std::endl;
+        return -1;
+    }
+    if (!args.cpu_limit.empty() && cgroup.set_cpu_limit(args.cpu_limit) != 0) {
+        std::cerr << "Failed to set CPU limit" << std::endl;
+        return -1;
+    }
+    if (!args.cpu_weight.empty() && cgroup.set_cpu_weight(args.cpu_weight) != 0) {
+        std::cerr << "Failed to set CPU weight" << std::endl;
+        return -1;
+    }
+    if (!args.pids_limit.empty() && cgroup.set_pids_limit(args.pids_limit) != 0) {
+        std::cerr << "Failed to set pids limit" << std::endl;
+        return -1;
+    }
+    if ((!args.cpuset_cpus.empty() || !args.cpuset_mems.empty()) &&
+        cgroup.set_cpuset(args.cpuset_cpus, args.cpuset_mems) != 0) {
+        std::cerr << "Failed to set cpuset" << std::endl;
+        return -1;
+    }
+    for (const auto& spec : args.io_max) {
+        if (cgroup.set_io_max(spec) != 0) {
+            std::cerr << "Failed to set io.max" << std::endl;
+            return -1;
+        }
+    }
+    for (const auto& spec : args.io_weight) {
+        if (cgroup.set_io_weight(spec) != 0) {
+            std::cerr << "Failed to set io.weight" << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// CPU list helpers for the kernel's "0-3,8,10-11" format
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    
+    while (std::getline(ss, range, ',')) {
+        range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+        if (range.empty()) continue;
+        
+        try {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception& e) {
+            return {};
+        }
+    }
+    
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::string format_cpu_list(std::vector<int> cpus) {
+    std::sort(cpus.begin(), cpus.end());
+    
+    std::string result;
+    size_t i = 0;
+    while (i < cpus.size()) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+        
+        if (!result.empty()) result += ",";
+        result += std::to_string(cpus[i]);
+        if (j > i) result += "-" + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return result;
+}
+
+std::string format_bytes(long long bytes) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f%s" : "%.1f%s", value, units[unit]);
+    return buf;
+}
+
+// Start time (in clock ticks since boot) of a process, used to detect PID reuse
+long long process_start_time(pid_t pid) {
+    std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+    std::string content;
+    if (!std::getline(stat_file, content)) return -1;
+    
+    // The command name may contain spaces, so skip past its closing parenthesis
+    size_t paren = content.rfind(')');
+    if (paren == std::string::npos) return -1;
+    
+    std::stringstream ss(content.substr(paren + 2));
+    std::string field;
+    // starttime is field 22; fields after the comm start at field 3
+    for (int i = 3; i <= 22; i++) {
+        if (!(ss >> field)) return -1;
+    }
+    
+    try {
+        return std::stoll(field);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+struct ContainerRecord {
+    std::string id;
+    pid_t supervisor_pid = 0;           // The "iza run" process that owns the container
+    long long supervisor_start = 0;     // Guards against supervisor PID reuse
+    pid_t container_pid = 0;
+    std::string cgroup_path;
+    std::string image;
+    std::string rootfs;
+    std::string lower;                  // Image layers, as OverlayFS::join_lower_dirs
+    std::string driver;                 // Storage driver that made rootfs; empty for bind mode
+    std::string base;                   // Tree a snapshot driver cloned rootfs from
+    std::string cpus;                   // cpuset.cpus held by this container
+    std::string mems;                   // cpuset.mems held by this container
+    long long started = 0;
+    std::string state = "running";      // running, paused, warming or pooled
+    std::string pool;                   // Warm pool this container belongs to
+};
+
+// Tracks running containers in <storage root>/containers so other iza
+// invocations (CPU placement, stats, ...) can see them.
+class ContainerRegistry {
+private:
+    std::string containers_dir = iza_storage_root() + "/containers";
+    int lock_fd = -1;
+    
+public:
+    ContainerRegistry() {
+        std::filesystem::create_directories(containers_dir);
+    }
+    
+    ~ContainerRegistry() {
+        unlock();
+    }
+    
+    // Serializes read-modify-write sequences (e.g. allocate CPUs, then save)
+    int lock() {
+        if (lock_fd >= 0) return 0;
+        
+        std::string lock_file = containers_dir + "/.lock";
+        lock_fd = open(lock_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lock_fd < 0) {
+            perror("Failed to open registry lock");
+            return -1;
+        }
+        if (flock(lock_fd, LOCK_EX) != 0) {
+            perror("Failed to lock registry");
+            close(lock_fd);
+            lock_fd = -1;
+            return -1;
+        }
+        return 0;
+    }
+    
+    void unlock() {
+        if (lock_fd < 0) return;
+        flock(lock_fd, LOCK_UN);
+        close(lock_fd);
+        lock_fd = -1;
+    }
+    
+    int save(const ContainerRecord& record) {
+        std::string state_file = containers_dir + "/" + record.id + ".state";
+        std::string tmp_file = state_file + ".tmp";
+        
+        std::ofstream out(tmp_file);
+        if (!out.is_open()) {
+            perror("Failed to write container state");
+            return -1;
+        }
+        
+        out << "id=" << record.id << "\n"
+            << "supervisor_pid=" << record.supervisor_pid << "\n"
+            << "supervisor_start=" << record.supervisor_start << "\n"
+            << "container_pid=" << record.container_pid << "\n"
+            << "cgroup=" << record.cgroup_path << "\n"
+            << "image=" << record.image << "\n"
+            << "rootfs=" << record.rootfs << "\n"
+            << "lower=" << record.lower << "\n"
+            << "driver=" << record.driver << "\n"
+            << "base=" << record.base << "\n"
+            << "cpus=" << record.cpus << "\n"
+            << "mems=" << record.mems << "\n"
+            << "started=" << record.started << "\n"
+            << "state=" << record.state << "\n"
+            << "pool=" << record.pool << "\n";
+        out.close();
+        
+        // Readers never see a half-written file
+        if (out.fail() || rename(tmp_file.c_str(), state_file.c_str()) != 0) {
+            perror("Failed to save container state");
+            std::filesystem::remove(tmp_file);
+            return -1;
+        }
+        return 0;
+    }
+    
+    void remove(const std::string& id) {
+        std::error_code ec;
+        std::filesystem::remove(containers_dir + "/" + id + ".state", ec);
+    }
+    
+    // Running containers only; records left behind by dead supervisors are pruned
+    std::vector<ContainerRecord> list() {
+        std::vector<ContainerRecord> records;
+        
+        for (const auto& entry : std::filesystem::directory_iterator(containers_dir)) {
+            if (entry.path().extension() != ".state") continue;
+            
+            ContainerRecord record;
+            if (load(entry.path().string(), record) != 0) continue;
+            
+            if (!is_alive(record)) {
+                std::error_code ec;
+                std::filesystem::remove(entry.path(), ec);
+                continue;
+            }
+            records.push_back(record);
+        }
+        
+        std::sort(records.begin(), records.end(), [](const auto& a, const auto& b) {
+            return a.started < b.started;
+        });
+        return records;
+    }
+    
+    // Accepts a full ID or a unique prefix
+    int find(const std::string& id, ContainerRecord& result) {
+        int matches = 0;
+        for (const auto& record : list()) {
+            if (record.id == id) {
+                result = record;
+                return 0;
+            }
+            if (record.id.starts_with(id)) {
+                result = record;
+                matches++;
+            }
+        }
+        
+        if (matches == 1) return 0;
+        if (matches > 1) {
+            std::cerr << "Error: Container ID '" << id << "' is ambiguous" << std::endl;
+        } else {
+            std::cerr << "Error: No running container '" << id << "'" << std::endl;
+        }
+        return -1;
+    }
+    
+private:
+    int load(const std::string& path, ContainerRecord& record) {
+        std::ifstream in(path);
+        if (!in.is_open()) return -1;
+        
+        std::string line;
+        try {
+            while (std::getline(in, line)) {
+                size_t eq = line.find('=');
+                if (eq == std::string::npos) continue;
+                std::string key = line.substr(0, eq);
+                std::string value = line.substr(eq + 1);
+                
+                if (key == "id") record.id = value;
+                else if (key == "supervisor_pid") record.supervisor_pid = std::stoi(value);
+                else if (key == "supervisor_start") record.supervisor_start = std::stoll(value);
+                else if (key == "container_pid") record.container_pid = std::stoi(value);
+                else if (key == "cgroup") record.cgroup_path = value;
+                else if (key == "image") record.image = value;
+                else if (key == "rootfs") record.rootfs = value;
+                else if (key == "lower") record.lower = value;
+                else if (key == "driver") record.driver = value;
+                else if (key == "base") record.base = value;
+                else if (key == "cpus") record.cpus = value;
+                else if (key == "mems") record.mems = value;
+                else if (key == "started") record.started = std::stoll(value);
+                else if (key == "state") record.state = value;
+                else if (key == "pool") record.pool = value;
+            }
+        } catch (const std::exception& e) {
+            return -1;
+        }
+        
+        return record.id.empty() ? -1 : 0;
+    }
+    
+    bool is_alive(const ContainerRecord& record) {
+        if (record.supervisor_pid <= 0) return false;
+        if (kill(record.supervisor_pid, 0) != 0 && errno != EPERM) return false;
+        return process_start_time(record.supervisor_pid) == record.supervisor_start;
+    }
+};
+
+// Whether a running container's rootfs was cloned from BASE
+bool snapshot_base_in_use(const std::string& base) {
+    ContainerRegistry registry;
+    for (const auto& record : registry.list()) {
+        if (record.base == base) return true;
+    }
+    return false;
+}
+
+struct CpuInfo {
+    int id;
+    int core;       // topology/core_id
+    int package;    // topology/physical_package_id
+    int node;       // NUMA node
+};
+
+// Host CPU and NUMA layout from sysfs. The root can be redirected with
+// IZA_SYSFS_ROOT to parse a fake sysfs tree.
+class HostTopology {
+private:
+    std::string sysfs_root = "/sys";
+    
+public:
+    std::vector<CpuInfo> cpus;
+    std::vector<int> nodes;
+    
+    HostTopology() {
+        char* env_root = getenv("IZA_SYSFS_ROOT");
+        if (env_root != nullptr) {
+            sysfs_root = env_root;
+        }
+    }
+    
+    int load() {
+        cpus.clear();
+        nodes.clear();
+        
+        std::string cpu_dir = sysfs_root + "/devices/system/cpu";
+        std::vector<int> online = parse_cpu_list(read_line(cpu_dir + "/online"));
+        if (online.empty()) {
+            std::cerr << "Error: Cannot read online CPUs from " << cpu_dir << "/online" << std::endl;
+            return -1;
+        }
+        
+        for (int id : online) {
+            std::string topo = cpu_dir + "/cpu" + std::to_string(id) + "/topology";
+            CpuInfo cpu;
+            cpu.id = id;
+            cpu.core = read_int(topo + "/core_id", id);
+            cpu.package = read_int(topo + "/physical_package_id", 0);
+            cpu.node = 0;
+            cpus.push_back(cpu);
+        }
+        
+        // Kernels without NUMA support have no node directory: treat as one node
+        std::string node_dir = sysfs_root + "/devices/system/node";
+        nodes = parse_cpu_list(read_line(node_dir + "/online"));
+        if (nodes.empty()) {
+            nodes.push_back(0);
+            return 0;
+        }
+        
+        for (int node : nodes) {
+            std::string cpulist = read_line(node_dir + "/node" + std::to_string(node) + "/cpulist");
+            for (int id : parse_cpu_list(cpulist)) {
+                for (auto& cpu : cpus) {
+                    if (cpu.id == id) cpu.node = node;
+                }
+            }
+        }
+        
+        return 0;
+    }
+    
+    std::vector<int> node_cpus(int node) const {
+        std::vector<int> result;
+        for (const auto& cpu : cpus) {
+            if (cpu.node == node) result.push_back(cpu.id);
+        }
+        return result;
+    }
+    
+    void print() const {
+        for (int node : nodes) {
+            std::cout << "node" << node << ": cpus " << format_cpu_list(node_cpus(node)) << std::endl;
+        }
+        printf("%-6s %-6s %-8s %s\n", "CPU", "NODE", "PACKAGE", "CORE");
+        for (const auto& cpu : cpus) {
+            printf("%-6d %-6d %-8d %d\n", cpu.id, cpu.node, cpu.package, cpu.core);
+        }
+    }
+    
+private:
+    std::string read_line(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+    
+    int read_int(const std::string& path, int fallback) {
+        try {
+            return std::stoi(read_line(path));
+        } catch (const std::exception& e) {
+            return fallback;
+        }
+    }
+};
+
+// Picks CPUs and a memory node for a new container, best-fit bin-packing
+// against the CPUs already held by running containers.
+class CpusetAllocator {
+private:
+    const HostTopology& topology;
+    std::vector<int> held;
+    
+public:
+    CpusetAllocator(const HostTopology& topo, const std::vector<ContainerRecord>& running)
+        : topology(topo) {
+        for (const auto& record : running) {
+            for (int cpu : parse_cpu_list(record.cpus)) {
+                held.push_back(cpu);
+            }
+        }
+    }
+    
+    int allocate(int count, std::string& cpus, std::string& mems) {
+        // Best fit: the node with the fewest free CPUs that still holds the whole
+        // request, so large nodes stay available for large containers
+        int best_node = -1;
+        size_t best_free = 0;
+        for (int node : topology.nodes) {
+            size_t free_count = free_cpus(node).size();
+            if (free_count >= (size_t)count && (best_node < 0 || free_count < best_free)) {
+                best_node = node;
+                best_free = free_count;
+            }
+        }
+        
+        if (best_node >= 0) {
+            cpus = format_cpu_list(pick_cpus(best_node, count));
+            mems = std::to_string(best_node);
+            return 0;
+        }
+        
+        // No single node fits: span nodes, emptiest first, and allow all their memory
+        std::vector<int> order = topology.nodes;
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return free_cpus(a).size() > free_cpus(b).size();
+        });
+        
+        std::vector<int> picked;
+        std::vector<int> picked_nodes;
+        for (int node : order) {
+            if ((int)picked.size() >= count) break;
+            std::vector<int> from_node = pick_cpus(node, count - (int)picked.size());
+            if (from_node.empty()) continue;
+            picked.insert(picked.end(), from_node.begin(), from_node.end());
+            picked_nodes.push_back(node);
+        }
+        
+        if ((int)picked.size() < count) {
+            std::cerr << "Error: Not enough free CPUs for --cpuset auto (requested "
+                      << count << ", free " << picked.size() << ")" << std::endl;
+            return -1;
+        }
+        
+        std::cout << "[CPUSET] Warning: no single NUMA node has " << count
+                  << " free CPUs, spanning nodes" << std::endl;
+        cpus = format_cpu_list(picked);
+        mems = format_cpu_list(picked_nodes);
+        return 0;
+    }
+    
+private:
+    std::vector<int> free_cpus(int node) const {
+        std::vector<int> result;
+        for (int cpu : topology.node_cpus(node)) {
+            if (std::find(held.begin(), held.end(), cpu) == held.end()) {
+                result.push_back(cpu);
+            }
+        }
+        return result;
+    }
+    
+    // Prefer whole free physical cores so the container doesn't share
+    // hyperthreads with a neighbor, then fill in leftover sibling threads
+    std::vector<int> pick_cpus(int node, int count) const {
+        std::vector<int> available = free_cpus(node);
+        std::vector<int> whole_core;
+        std::vector<int> partial_core;
+        
+        for (int id : available) {
+            const CpuInfo* cpu = find_cpu(id);
+            bool core_free = true;
+            for (const auto& other : topology.cpus) {
+                if (other.package == cpu->package && other.core == cpu->core &&
+                    std::find(available.begin(), available.end(), other.id) == available.end()) {
+                    core_free = false;
+                }
+            }
+            (core_free ? whole_core : partial_core).push_back(id);
+        }
+        
+        // Keep sibling threads adjacent so whole cores are handed out together
+        auto by_core = [this](int a, int b) {
+            const CpuInfo* ca = find_cpu(a);
+            const CpuInfo* cb = find_cpu(b);
+            if (ca->package != cb->package) return ca->package < cb->package;
+            if (ca->core != cb->core) return ca->core < cb->core;
+            return a < b;
+        };
+        std::sort(whole_core.begin(), whole_core.end(), by_core);
+        std::sort(partial_core.begin(), partial_core.end(), by_core);
+        
+        std::vector<int> picked;
+        for (int id : whole_core) {
+            if ((int)picked.size() >= count) break;
+            picked.push_back(id);
+        }
+        for (int id : partial_core) {
+            if ((int)picked.size() >= count) break;
+            picked.push_back(id);
+        }
+        return picked;
+    }
+    
+    const CpuInfo* find_cpu(int id) const {
+        for (const auto& cpu : topology.cpus) {
+            if (cpu.id == id) return &cpu;
+        }
+        return nullptr;
+    }
+};
+
+// "iza slice": aggregate limits on the parent cgroup of all containers
+int slice_command(const Arguments& args) {
+    if (!CgroupManager::available()) {
+        std::cerr << "Error: cgroups v2 not available" << std::endl;
+        return 1;
+    }
+    
+    std::string slice_path = CgroupManager::resolve_parent(args.cgroup_parent);
+    if (CgroupManager::ensure_slice(slice_path) != 0) {
+        return 1;
+    }
+    
+    CgroupManager slice(slice_path);
+    if (args.has_resource_limits() && apply_resource_limits(slice, args) != 0) {
+        return 1;
+    }
+    
+    slice.print_summary();
+    return 0;
+}
+
+// Interface files an update will touch, for snapshot/rollback
+std::vector<std::string> limit_files(const Arguments& args) {
+    std::vector<std::pair<bool, std::string>> candidates = {
+        {!args.memory_limit.empty(), "memory.max"},
+        {!args.memory_high.empty(), "memory.high"},
+        {!args.memory_low.empty(), "memory.low"},
+        {!args.memory_min.empty(), "memory.min"},
+        {!args.memory_swap.empty(), "memory.swap.max"},
+        {!args.cpu_limit.empty(), "cpu.max"},
+        {!args.cpu_weight.empty(), "cpu.weight"},
+        {!args.pids_limit.empty(), "pids.max"},
+        {!args.cpuset_cpus.empty(), "cpuset.cpus"},
+        {!args.cpuset_mems.empty(), "cpuset.mems"},
+        {!args.io_max.empty(), "io.max"},
+        {!args.io_weight.empty(), "io.weight"}
+    };
+    
+    std::vector<std::string> files;
+    for (const auto& [requested, file] : candidates) {
+        if (requested) files.push_back(file);
+    }
+    return files;
+}
+
+// "iza update": change limits of a running container all-or-nothing
+int update_command(const Arguments& args) {
+    ContainerRegistry registry;
+    if (registry.lock() != 0) {
+        return 1;
+    }
+    
+    ContainerRecord record;
+    if (registry.find(args.container_id, record) != 0) {
+        return 1;
+    }
+    if (record.cgroup_path.empty()) {
+        std::cerr << "Error: Container " << record.id << " has no cgroup" << std::endl;
+        return 1;
+    }
+    
+    CgroupManager cgroup(record.cgroup_path);
+    if (!cgroup.is_created()) {
+        std::cerr << "Error: Cgroup " << record.cgroup_path << " no longer exists" << std::endl;
+        return 1;
+    }
+    
+    // Limits below current usage make the kernel reclaim hard or OOM-kill right away
+    if (!args.memory_limit.empty() && args.memory_limit != "max") {
+        long long requested = cgroup.limit_bytes(args.memory_limit);
+        long long current = cgroup.read_value("memory.current");
+        if (requested > 0 && current > requested && !args.force) {
+            std::cerr << "Error: memory.max " << args.memory_limit << " is below current usage ("
+                      << format_bytes(current) << "); use --force to apply anyway" << std::endl;
+            return 1;
+        }
+    }
+    if (!args.pids_limit.empty() && args.pids_limit != "max") {
+        long long current = cgroup.read_value("pids.current");
+        long long requested = -1;
+        try {
+            requested = std::stoll(args.pids_limit);
+        } catch (const std::exception& e) {
+            requested = -1;
+        }
+        if (requested > 0 && current > requested && !args.force) {
+            std::cerr << "Error: pids limit " << requested << " is below the current process count ("
+                      << current << "); use --force to apply anyway" << std::endl;
+            return 1;
+        }
+    }
+    
+    std::map<std::string, std::string> saved = cgroup.snapshot(limit_files(args));
+    if (apply_resource_limits(cgroup, args) != 0) {
+        std::cerr << "[UPDATE] Rolling back " << record.id << " to its previous limits" << std::endl;
+        cgroup.restore(saved);
+        return 1;
+    }
+    
+    if (!args.cpuset_cpus.empty() || !args.cpuset_mems.empty()) {
+        if (!args.cpuset_cpus.empty()) record.cpus = args.cpuset_cpus;
+        if (!args.cpuset_mems.empty()) record.mems = args.cpuset_mems;
+        registry.save(record);
+    }
+    
+    std::cout << "[UPDATE] Updated " << record.id << std::endl;
+    return 0;
+}
+
+// "iza pause" / "iza resume": freeze or thaw every task in the container's cgroup
+int pause_command(const Arguments& args) {
+    // Held until the new state is saved, so it can't overwrite a concurrent update
+    ContainerRegistry registry;
+    if (registry.lock() != 0) {
+        return 1;
+    }
+    
+    ContainerRecord record;
+    if (registry.find(args.container_id, record) != 0) {
+        return 1;
+    }
+    
+    CgroupManager cgroup(record.cgroup_path);
+    if (record.cgroup_path.empty() || !cgroup.is_created()) {
+        std::cerr << "Error: Container " << record.id << " has no cgroup" << std::endl;
+        return 1;
+    }
+    
+    bool pause = args.command_type == "pause";
+    if (cgroup.set_frozen(pause) != 0) {
+        return 1;
+    }
+    
+    record.state = pause ? "paused" : "running";
+    registry.save(record);
+    registry.unlock();
+    
+    std::cout << (pause ? "[PAUSE] Paused " : "[RESUME] Resumed ") << record.id << std::endl;
+    return 0;
+}
+
+// Detached "iza run --pool NAME ..." processes; each freezes itself once ready
+int pool_start(const Arguments& args) {
+    int size = 0;
+    try {
+        size = std::stoi(args.pool_size);
+    } catch (const std::exception& e) {
+        size = 0;
+    }
+    if (size <= 0) {
+        std::cerr << "Error: Invalid pool size '" << args.pool_size << "'" << std::endl;
+        return 1;
+    }
+    
+    std::string log_dir = iza_storage_root() + "/pools/" + args.pool_name;
+    std::filesystem::create_directories(log_dir);
+    
+    for (int k = 0; k < size; k++) {
+        std::string log_file = log_dir + "/" + std::to_string(time(nullptr)) + "-" + std::to_string(k) + ".log";
+        
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("Failed to start pool member");
+            return 1;
+        }
+        if (pid == 0) {
+            // Outlive this command and its terminal
+            setsid();
+            int null_fd = open("/dev/null", O_RDONLY);
+            int log_fd = open(log_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (null_fd >= 0) dup2(null_fd, STDIN_FILENO);
+            if (log_fd >= 0) {
+                dup2(log_fd, STDOUT_FILENO);
+                dup2(log_fd, STDERR_FILENO);
+            }
+            
+            std::vector<std::string> run_args = {"iza", "run", "--pool", args.pool_name};
+            run_args.insert(run_args.end(), args.pool_run_args.begin(), args.pool_run_args.end());
+            std::vector<char*> exec_args;
+            for (auto& arg : run_args) {
+                exec_args.push_back(arg.data());
+            }
+            exec_args.push_back(nullptr);
+            
+            execv("/proc/self/exe", exec_args.data());
+            perror("Failed to exec iza run");
+            _exit(127);
+        }
+        std::cout << "[POOL] Started member " << k + 1 << "/" << size << " (PID " << pid << ", log " << log_file << ")" << std::endl;
+    }
+    return 0;
+}
+
+// Claims a frozen member under the registry lock, so two requests never get the same one
+int pool_take(const Arguments& args) {
+    ContainerRegistry registry;
+    if (registry.lock() != 0) {
+        return 1;
+    }
+    
+    ContainerRecord claimed;
+    for (const auto& record : registry.list()) {
+        if (record.pool == args.pool_name && record.state == "pooled") {
+            claimed = record;
+            break;
+        }
+    }
+    if (claimed.id.empty()) {
+        std::cerr << "Error: No warm container available in pool '" << args.pool_name << "'" << std::endl;
+        return 1;
+    }
+    
+    // Thaw before recording the claim: a member that stays frozen stays pooled
+    CgroupManager cgroup(claimed.cgroup_path);
+    if (cgroup.set_frozen(false) != 0) {
+        return 1;
+    }
+    claimed.state = "running";
+    registry.save(claimed);
+    registry.unlock();
+    
+    std::cout << claimed.id << std::endl;
+    return 0;
+}
+
+int pool_command(const Arguments& args) {
+    if (args.pool_action == "start") {
+        return pool_start(args);
+    } else if (args.pool_action == "take") {
+        return pool_take(args);
+    }
+    
+    ContainerRegistry registry;
+    if (args.pool_action == "list") {
+        printf("%-28s %-16s %s\n", "CONTAINER ID", "POOL", "STATE");
+    }
+    for (const auto& record : registry.list()) {
+        if (record.pool.empty()) continue;
+        
+        if (args.pool_action == "list") {
+            printf("%-28s %-16s %s\n", record.id.c_str(), record.pool.c_str(), record.state.c_str());
+        } else if (record.pool == args.pool_name) {
+            // The member's supervisor sees the exit and cleans up as usual
+            CgroupManager cgroup(record.cgroup_path);
+            cgroup.kill_processes();
+            std::cout << "[POOL] Stopped " << record.id << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Warm pool readiness: the ready file exists inside the container, or without
+// one, the entrypoint has been exec'd
+bool pool_member_ready(pid_t container_pid, const std::string& ready_file) {
+    std::string proc = "/proc/" + std::to_string(container_pid);
+    if (!ready_file.empty()) {
+        return access((proc + "/root" + ready_file).c_str(), F_OK) == 0;
+    }
+    
+    std::error_code ec1, ec2;
+    auto exe = std::filesystem::read_symlink(proc + "/exe", ec1);
+    auto self = std::filesystem::read_symlink("/proc/self/exe", ec2);
+    return !ec1 && !ec2 && exe != self;
+}
+
+// "iza commit": the container's upper dir becomes a layer of a new image. The
+// container is frozen meanwhile so the layer is a consistent snapshot.
+int commit_command(const Arguments& args) {
+    ContainerRegistry registry;
+    ContainerRecord record;
+    if (registry.find(args.container_id, record) != 0) {
+        return 1;
+    }
+    if (record.image.empty()) {
+        std::cerr << "Error: Container " << record.id << " has no image (legacy mode)" << std::endl;
+        return 1;
+    }
+    
+    if (record.driver != "overlay") {
+        std::cerr << "Error: Container " << record.id << " uses the " << record.driver
+                  << " storage driver; commit needs overlay" << std::endl;
+        return 1;
+    }
+    std::string upper_dir = std::filesystem::path(record.rootfs).parent_path().string() + "/upper";
+    if (!std::filesystem::exists(upper_dir)) {
+        std::cerr << "Error: Container " << record.id << " has no writable layer (--read-only)" << std::endl;
+        return 1;
+    }
+    
+    CgroupManager cgroup(record.cgroup_path);
+    bool freeze = !record.cgroup_path.empty() && cgroup.is_created() && record.state == "running";
+    if (freeze && cgroup.set_frozen(true) != 0) {
+        return 1;
+    }
+    
+    // The container's own view of its root, also for rootless overlays mounted in its namespace
+    std::string merged_dir = "/proc/" + std::to_string(record.container_pid) + "/root";
+    ImageManager image_manager;
+    int result = image_manager.commit_image(upper_dir, merged_dir, record.image, args.image_name);
+    
+    if (freeze) {
+        cgroup.set_frozen(false);
+    }
+    return result == 0 ? 0 : 1;
+}
+
+int diff_command(const Arguments& args) {
+    ContainerRegistry registry;
+    ContainerRecord record;
+    if (registry.find(args.container_id, record) != 0) {
+        return 1;
+    }
+    
+    if (record.driver.empty()) {
+        std::cerr << "Error: Container " << record.id << " runs on host directories (--rootfs-mode bind)" << std::endl;
+        return 1;
+    }
+    
+    std::vector<std::pair<std::string, char>> changes;
+    int result = make_storage_driver(record.driver)->diff(record.rootfs, OverlayFS::split_lower_dirs(record.lower),
+                                                             record.base, changes);
+    for (const auto& [path, kind] : changes) {
+        std::cout << kind << " " << path << "\n";
+    }
+    return result == 0 ? 0 : 1;
+}
+
+// "iza prune": tear down cgroups whose containers are gone
+int prune_command(const Arguments& args) {
+    if (!CgroupManager::available()) {
+        std::cerr << "Error: cgroups v2 not available" << std::endl;
+        return 1;
+    }
+    
+    ContainerRegistry registry;
+    if (registry.lock() != 0) {
+        return 1;
+    }
+    
+    std::vector<std::string> in_use;
+    for (const auto& record : registry.list()) {
+        in_use.push_back(record.cgroup_path);
+    }
+    
+    return CgroupManager::prune(CgroupManager::resolve_parent(args.cgroup_parent), in_use) == 0 ? 0 : 1;
+}
+
+// Choose CPUs/memory node for --cpuset auto and record them before releasing
+// the registry lock, so concurrent runs never pick the same CPUs
+int allocate_cpuset(Arguments& args, ContainerRegistry& registry, ContainerRecord& record) {
+    HostTopology topology;
+    if (topology.load() != 0) {
+        return -1;
+    }
+    
+    int count = 1;
+    if (!args.cpu_limit.empty()) {
+        try {
+            count = std::max(1, (int)std::ceil(std::stod(args.cpu_limit)));
+        } catch (const std::exception& e) {
+            std::cerr << "Error: Invalid CPU limit '" << args.cpu_limit << "'" << std::endl;
+            return -1;
+        }
+    }
+    
+    if (registry.lock() != 0) {
+        return -1;
+    }
+    
+    CpusetAllocator allocator(topology, registry.list());
+    if (allocator.allocate(count, args.cpuset_cpus, args.cpuset_mems) != 0) {
+        registry.unlock();
+        return -1;
+    }
+    
+    record.cpus = args.cpuset_cpus;
+    record.mems = args.cpuset_mems;
+    int result = registry.save(record);
+    registry.unlock();
+    
+    std::cout << "[CPUSET] Placed on CPUs " << args.cpuset_cpus << ", memory node(s) " << args.cpuset_mems << std::endl;
+    return result;
+}
+
+struct CgroupSample {
+    long long timestamp_usec = 0;
+    long long cpu_usage_usec = 0;
+    long long memory_current = -1;
+    long long memory_max = -1;          // -1 when unlimited ("max")
+    long long memory_anon = 0;
+    long long memory_file = 0;
+    long long io_read_bytes = 0;
+    long long io_write_bytes = 0;
+    long long pids_current = -1;
+};
+
+// Reads a container's cgroup accounting files through fds kept open for the
+// lifetime of the object; every sample is a handful of pread() calls.
+class CgroupStats {
+private:
+    std::string cgroup_path;
+    std::vector<std::pair<std::string, int>> fds;
+    std::string buffer;
+    
+public:
+    CgroupStats(const std::string& path) : cgroup_path(path) {
+        buffer.resize(8192);
+        for (const char* file : {"cpu.stat", "memory.current", "memory.max", "memory.stat", "io.stat", "pids.current"}) {
+            std::string full_path = cgroup_path + "/" + file;
+            // Missing files just mean the controller isn't enabled for this cgroup
+            fds.push_back({file, open(full_path.c_str(), O_RDONLY | O_CLOEXEC)});
+        }
+    }
+    
+    ~CgroupStats() {
+        for (const auto& [file, fd] : fds) {
+            if (fd >= 0) close(fd);
+        }
+    }
+    
+    CgroupStats(const CgroupStats&) = delete;
+    CgroupStats& operator=(const CgroupStats&) = delete;
+    
+    bool is_open() const {
+        return fd_for("cpu.stat") >= 0;
+    }
+    
+    int sample(CgroupSample& s) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        s.timestamp_usec = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+        
+        std::string content;
+        if (read_fd(fd_for("cpu.stat"), content) != 0) {
+            // cpu.stat always exists, so failing here means the cgroup is gone
+            return -1;
+        }
+        s.cpu_usage_usec = stat_value(content, "usage_usec");
+        
+        if (read_fd(fd_for("memory.current"), content) == 0) {
+            s.memory_current = to_number(content);
+        }
+        if (read_fd(fd_for("memory.max"), content) == 0) {
+            s.memory_max = content.starts_with("max") ? -1 : to_number(content);
+        }
+        if (read_fd(fd_for("memory.stat"), content) == 0) {
+            s.memory_anon = stat_value(content, "anon");
+            s.memory_file = stat_value(content, "file");
+        }
+        if (read_fd(fd_for("pids.current"), content) == 0) {
+            s.pids_current = to_number(content);
+        }
+        if (read_fd(fd_for("io.stat"), content) == 0) {
+            // One line per device: "8:0 rbytes=N wbytes=N rios=N ..."
+            s.io_read_bytes = 0;
+            s.io_write_bytes = 0;
+            std::stringstream lines(content);
+            std::string line;
+            while (std::getline(lines, line)) {
+                std::stringstream fields(line);
+                std::string field;
+                while (fields >> field) {
+                    if (field.starts_with("rbytes=")) s.io_read_bytes += to_number(field.substr(7));
+                    else if (field.starts_with("wbytes=")) s.io_write_bytes += to_number(field.substr(7));
+                }
+            }
+        }
+        return 0;
+    }
+    
+private:
+    int fd_for(const std::string& file) const {
+        for (const auto& [name, fd] : fds) {
+            if (name == file) return fd;
+        }
+        return -1;
+    }
+    
+    int read_fd(int fd, std::string& content) {
+        if (fd < 0) return -1;
+        
+        // cgroupfs regenerates the file on every read from offset 0
+        ssize_t n;
+        while ((n = pread(fd, buffer.data(), buffer.size(), 0)) == (ssize_t)buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+        if (n < 0) return -1;
+        
+        content.assign(buffer.data(), n);
+        return 0;
+    }
+    
+    static long long stat_value(const std::string& content, const std::string& key) {
+        std::stringstream ss(content);
+        std::string name;
+        long long value;
+        while (ss >> name >> value) {
+            if (name == key) return value;
+        }
+        return 0;
+    }
+    
+    static long long to_number(const std::string& text) {
+        try {
+            return std::stoll(text);
+        } catch (const std::exception& e) {
+            return 0;
+        }
+    }
+};
+
+struct PerfSample {
+    bool software = false;              // false when no perf events could be opened
+    bool hardware = false;              // false without a usable PMU (most VMs)
+    long long cycles = 0;
+    long long instructions = 0;
+    long long cache_references = 0;
+    long long cache_misses = 0;
+    long long context_switches = 0;
+    long long page_faults = 0;
+};
+
+// Cgroup-mode perf events: one counter per event per CPU, counting only while
+// a task of the container's cgroup runs there. Hardware events of a CPU share
+// a group so IPC and miss rates come from the same time slices.
+class CgroupPerfCounters {
+private:
+    struct CpuCounters {
+        int leader = -1;                // cycles; instructions and cache events follow it
+        std::vector<int> hardware;
+        int context_switches = -1;
+        int page_faults = -1;
+    };
+    std::vector<CpuCounters> cpus;
+    bool hardware = true;
+    
+public:
+    // Returns with is_open() false when even software events can't be opened
+    CgroupPerfCounters(CgroupManager& cgroup) {
+        int cgroup_fd = cgroup.open_dir();
+        if (cgroup_fd < 0) return;
+        
+        std::string online;
+        std::ifstream in("/sys/devices/system/cpu/online");
+        std::getline(in, online);
+        
+        for (int cpu : parse_cpu_list(online)) {
+            CpuCounters counters;
+            if (hardware) {
+                counters.leader = open_event(cgroup_fd, cpu, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+                if (counters.leader < 0) {
+                    // ENOENT/EOPNOTSUPP/ENODEV: no PMU exposed to us; software counters still work
+                    if (errno != EACCES && errno != EPERM) {
+                        std::cerr << "[PERF] Hardware counters unavailable (" << strerror(errno)
+                                  << "), reporting software events only" << std::endl;
                     }
-                    
-                    // Parse name:tag
-                    size_t colon = image_name.find(':');
-                    std::string repo, tag;
-                    if (colon != std::string::npos) {
-                        repo = image_name.substr(0, colon);
-                        tag = image_name.substr(colon + 1);
-                    } else {
-                        repo = image_name;
-                        tag = "latest";
+                    hardware = false;
+                } else {
+                    for (auto config : {PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES}) {
+                        counters.hardware.push_back(open_event(cgroup_fd, cpu, PERF_TYPE_HARDWARE, config, counters.leader));
                     }
-                    
-                    printf("%-20s %-9s %s\n", repo.c_str(), tag.c_str(), size_str.c_str());
                 }
             }
+            counters.context_switches = open_event(cgroup_fd, cpu, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, -1);
+            counters.page_faults = open_event(cgroup_fd, cpu, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, -1);
+            
+            if (counters.context_switches < 0) {
+                std::cerr << "[PERF] Cannot open perf events for " << cgroup.path() << ": " << strerror(errno)
+                          << (errno == EACCES || errno == EPERM ? " (needs root or kernel.perf_event_paranoid <= 0)" : "")
+                          << std::endl;
+                close_counters(counters);
+                close_all();
+                break;
+            }
+            cpus.push_back(counters);
         }
+        close(cgroup_fd);
+        
+        if (cpus.empty()) hardware = false;
+    }
+    
+    ~CgroupPerfCounters() {
+        close_all();
+    }
+    
+    CgroupPerfCounters(const CgroupPerfCounters&) = delete;
+    CgroupPerfCounters& operator=(const CgroupPerfCounters&) = delete;
+    
+    bool is_open() const {
+        return !cpus.empty();
+    }
+    
+    // Running totals since the counters were opened, summed over all CPUs
+    int sample(PerfSample& s) {
+        s = PerfSample();
+        s.software = is_open();
+        s.hardware = hardware;
         
+        for (const auto& counters : cpus) {
+            s.context_switches += read_counter(counters.context_switches);
+            s.page_faults += read_counter(counters.page_faults);
+            
+            if (counters.leader < 0) continue;
+            
+            // PERF_FORMAT_GROUP: nr, time_enabled, time_running, then one value per member
+            uint64_t values[3 + 4] = {};
+            if (read(counters.leader, values, sizeof(values)) < (ssize_t)(3 * sizeof(uint64_t))) continue;
+            if (values[2] == 0) continue;  // Never scheduled on the PMU
+            
+            // Scale up for the time the group was multiplexed off the PMU
+            double scale = (double)values[1] / values[2];
+            s.cycles += (long long)(values[3] * scale);
+            
+            // Members that failed to open (e.g. no cache events) are not in the group
+            long long* members[] = {&s.instructions, &s.cache_references, &s.cache_misses};
+            size_t next = 4;
+            for (size_t j = 0; j < counters.hardware.size(); j++) {
+                if (counters.hardware[j] < 0 || next >= 3 + values[0]) continue;
+                *members[j] += (long long)(values[next++] * scale);
+            }
+        }
         return 0;
     }
     
-    std::string get_image_rootfs(const std::string& image_name) {
-        std::string image_dir = images_dir + "/" + image_name;
-        std::string rootfs_dir = image_dir + "/rootfs";
+private:
+    static int open_event(int cgroup_fd, int cpu, uint32_t type, uint64_t config, int group_fd) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.exclude_hv = 1;
+        if (type == PERF_TYPE_HARDWARE && group_fd < 0) {
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        }
+        
+        int fd = syscall(SYS_perf_event_open, &attr, cgroup_fd, cpu, group_fd,
+                         PERF_FLAG_PID_CGROUP | PERF_FLAG_FD_CLOEXEC);
+        return fd;
+    }
+    
+    static long long read_counter(int fd) {
+        uint64_t value = 0;
+        if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+        return (long long)value;
+    }
+    
+    static void close_counters(const CpuCounters& counters) {
+        for (int fd : counters.hardware) {
+            if (fd >= 0) close(fd);
+        }
+        for (int fd : {counters.leader, counters.context_switches, counters.page_faults}) {
+            if (fd >= 0) close(fd);
+        }
+    }
+    
+    void close_all() {
+        for (const auto& counters : cpus) {
+            close_counters(counters);
+        }
+        cpus.clear();
+    }
+};
+
+struct MemoryEvents {
+    long long high = 0;
+    long long max = 0;
+    long long oom = 0;
+    long long oom_kill = 0;
+};
+
+// Watches a running container from the parent: memory.events through inotify
+// and PSI triggers on the *.pressure files, until the container exits.
+class ContainerSupervisor {
+private:
+    std::string cgroup_path;
+    pid_t container_pid;
+    int pressure_threshold_us;          // Stall time per window that fires a trigger
+    std::string pressure_action;        // "log" or "relax"
+    int pidfd = -1;
+    int inotify_fd = -1;
+    std::vector<std::pair<std::string, int>> triggers;
+    MemoryEvents baseline;
+    MemoryEvents last;
+    std::vector<std::function<void()>> tick_handlers;
+    
+    static constexpr int pressure_window_us = 2000000;  // Unprivileged triggers need >= 2s
+    static constexpr int tick_ms = 1000;
+    
+public:
+    ContainerSupervisor(const std::string& path, pid_t pid, const std::string& threshold_ms, const std::string& action)
+        : cgroup_path(path), container_pid(pid), pressure_action(action) {
+        pressure_threshold_us = 100000;
+        try {
+            pressure_threshold_us = std::stoi(threshold_ms) * 1000;
+        } catch (const std::exception& e) {
+            std::cerr << "[MONITOR] Invalid pressure threshold '" << threshold_ms << "', using 100ms" << std::endl;
+        }
+    }
+    
+    ~ContainerSupervisor() {
+        if (pidfd >= 0) close(pidfd);
+        if (inotify_fd >= 0) close(inotify_fd);
+        for (const auto& [resource, fd] : triggers) {
+            close(fd);
+        }
+    }
+    
+    ContainerSupervisor(const ContainerSupervisor&) = delete;
+    ContainerSupervisor& operator=(const ContainerSupervisor&) = delete;
+    
+    int start() {
+        pidfd = syscall(SYS_pidfd_open, container_pid, 0);
+        if (pidfd < 0) {
+            // Pre-5.3 kernels: fall back to polling waitpid once a second
+            std::cout << "[MONITOR] pidfd unavailable, polling for exit" << std::endl;
+        }
         
-        if (std::filesystem::exists(rootfs_dir)) {
-            return rootfs_dir;
+        read_memory_events(baseline);
+        last = baseline;
+        
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        std::string events_file = cgroup_path + "/memory.events";
+        if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, events_file.c_str(), IN_MODIFY) < 0) {
+            // No memory controller in this cgroup
+            close(inotify_fd);
+            inotify_fd = -1;
         }
         
-        return "";
+        for (const char* resource : {"memory", "cpu", "io"}) {
+            std::string pressure_file = cgroup_path + "/" + resource + ".pressure";
+            int fd = open(pressure_file.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0) continue;
+            
+            std::string trigger = "some " + std::to_string(pressure_threshold_us) + " " +
+                                  std::to_string(pressure_window_us);
+            if (write(fd, trigger.c_str(), trigger.size() + 1) < 0) {
+                std::cout << "[MONITOR] Cannot register " << resource << " PSI trigger: " << strerror(errno) << std::endl;
+                close(fd);
+                continue;
+            }
+            triggers.push_back({resource, fd});
+        }
+        
+        if (inotify_fd >= 0 || !triggers.empty()) {
+            std::cout << "[MONITOR] Watching memory.events and " << triggers.size() << " PSI trigger(s)" << std::endl;
+        }
+        return 0;
+    }
+    
+    // Runs a feedback policy about once a second while the container is alive
+    void on_tick(std::function<void()> handler) {
+        tick_handlers.push_back(handler);
+    }
+    
+    // Returns the waitpid() result once the container has exited
+    pid_t wait(int& status) {
+        std::vector<struct pollfd> fds;
+        if (pidfd >= 0) fds.push_back({pidfd, POLLIN, 0});
+        if (inotify_fd >= 0) fds.push_back({inotify_fd, POLLIN, 0});
+        for (const auto& [resource, fd] : triggers) {
+            fds.push_back({fd, POLLPRI, 0});
+        }
+        
+        long long next_tick = monotonic_ms() + tick_ms;
+        
+        for (;;) {
+            if (pidfd < 0) {
+                pid_t result = waitpid(container_pid, &status, WNOHANG);
+                if (result != 0) return result;
+            }
+            
+            int timeout = pidfd >= 0 ? -1 : tick_ms;
+            if (!tick_handlers.empty()) {
+                long long now = monotonic_ms();
+                if (now >= next_tick) {
+                    for (const auto& handler : tick_handlers) {
+                        handler();
+                    }
+                    next_tick = now + tick_ms;
+                }
+                timeout = (int)(next_tick - now);
+            }
+            
+            int ready = poll(fds.data(), fds.size(), timeout);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                perror("[MONITOR] poll failed");
+                return waitpid(container_pid, &status, 0);
+            }
+            
+            for (const auto& pfd : fds) {
+                if (pfd.revents == 0) continue;
+                
+                if (pfd.fd == pidfd) {
+                    check_memory_events();
+                    pid_t result;
+                    while ((result = waitpid(container_pid, &status, 0)) < 0 && errno == EINTR) {}
+                    return result;
+                } else if (pfd.fd == inotify_fd) {
+                    drain_inotify();
+                    check_memory_events();
+                } else if (pfd.revents & POLLERR) {
+                    // The cgroup went away underneath us
+                    std::cerr << "[MONITOR] PSI trigger lost" << std::endl;
+                    return waitpid(container_pid, &status, 0);
+                } else {
+                    handle_pressure(pfd.fd);
+                }
+            }
+        }
+    }
+    
+    static long long monotonic_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+    
+    bool oom_killed() {
+        MemoryEvents current;
+        read_memory_events(current);
+        return current.oom_kill > baseline.oom_kill;
     }
     
 private:
-    int download_file(const std::string& url, const std::string& output_path) {
-        std::cout << "[DOWNLOAD] Downloading from: " << url << std::endl;
+    int read_memory_events(MemoryEvents& events) {
+        std::ifstream in(cgroup_path + "/memory.events");
+        if (!in.is_open()) return -1;
         
-        CURL *curl;
-        CURLcode res;
-        FILE *fp;
+        std::string key;
+        long long value;
+        while (in >> key >> value) {
+            if (key == "high") events.high = value;
+            else if (key == "max") events.max = value;
+            else if (key == "oom") events.oom = value;
+            else if (key == "oom_kill") events.oom_kill = value;
+        }
+        return 0;
+    }
+    
+    void drain_inotify() {
+        char buf[4096];
+        while (read(inotify_fd, buf, sizeof(buf)) > 0) {}
+    }
+    
+    void check_memory_events() {
+        MemoryEvents current;
+        if (read_memory_events(current) != 0) return;
         
-        curl = curl_easy_init();
-        if (!curl) {
-            std::cerr << "Failed to initialize curl" << std::endl;
+        if (current.high > last.high) {
+            std::cout << "[MONITOR] Throttled at memory.high (" << current.high - last.high
+                      << " new event(s), " << current.high << " total)" << std::endl;
+        }
+        if (current.max > last.max) {
+            std::cout << "[MONITOR] Hit memory.max, reclaiming (" << current.max << " total)" << std::endl;
+        }
+        if (current.oom_kill > last.oom_kill) {
+            std::cout << "[MONITOR] OOM killer fired inside the container ("
+                      << current.oom_kill - last.oom_kill << " process(es) killed)" << std::endl;
+        }
+        last = current;
+    }
+    
+    void handle_pressure(int fd) {
+        std::string resource;
+        for (const auto& [name, trigger_fd] : triggers) {
+            if (trigger_fd == fd) resource = name;
+        }
+        
+        // The trigger fd doubles as a reader for the current averages
+        char buf[256];
+        ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+        std::string summary;
+        if (n > 0) {
+            buf[n] = '\0';
+            summary = buf;
+            summary = summary.substr(0, summary.find('\n'));
+        }
+        
+        std::cout << "[MONITOR] " << resource << " pressure above " << pressure_threshold_us / 1000
+                  << "ms per " << pressure_window_us / 1000000 << "s: " << summary << std::endl;
+        
+        if (resource == "memory" && pressure_action == "relax") {
+            relax_memory_high();
+        }
+    }
+    
+    // Raise memory.high by 10%, never past memory.max
+    void relax_memory_high() {
+        long long high = read_limit("memory.high");
+        long long max = read_limit("memory.max");
+        if (high < 0) return;  // Unlimited: nothing is throttling us
+        
+        long long raised = high + high / 10;
+        if (max >= 0) raised = std::min(raised, max);
+        if (raised <= high) return;
+        
+        std::ofstream out(cgroup_path + "/memory.high");
+        out << raised;
+        out.close();
+        if (!out.fail()) {
+            std::cout << "[MONITOR] Raised memory.high to " << format_bytes(raised) << std::endl;
+        }
+    }
+    
+    long long read_limit(const std::string& file) {
+        std::ifstream in(cgroup_path + "/" + file);
+        std::string value;
+        if (!(in >> value) || value == "max") return -1;
+        try {
+            return std::stoll(value);
+        } catch (const std::exception& e) {
+            return -1;
+        }
+    }
+};
+
+// Feedback loop on CFS bandwidth throttling: when cpu.stat shows the container
+// hitting its quota, grant burst, shorten the period, then raise the quota,
+// all within user-set bounds; give quota back once throttling stops.
+class CpuQuotaController {
+private:
+    CgroupManager cgroup;
+    double base_cores;
+    double max_cores;
+    double burst_max_cores;
+    long period_min_us;
+    long period_max_us;
+    
+    double quota_cores;
+    long period_us;
+    long burst_us = 0;
+    bool burst_supported = true;
+    int calm_ticks = 0;
+    int stat_fd = -1;
+    long long last_periods = -1;
+    long long last_throttled = 0;
+    long long last_usage = 0;
+    long long last_time_us = 0;
+    
+    static constexpr double throttle_threshold = 0.05;  // Fraction of periods throttled
+    static constexpr int calm_ticks_before_decay = 10;
+    
+public:
+    CpuQuotaController(const std::string& cgroup_path, double base, double max, double burst_max,
+                       long period_min, long period_max)
+        : cgroup(cgroup_path), base_cores(base), max_cores(max), burst_max_cores(burst_max),
+          period_min_us(period_min), period_max_us(period_max), quota_cores(base), period_us(period_max) {
+        stat_fd = open((cgroup_path + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    
+    ~CpuQuotaController() {
+        if (stat_fd >= 0) close(stat_fd);
+    }
+    
+    CpuQuotaController(const CpuQuotaController&) = delete;
+    CpuQuotaController& operator=(const CpuQuotaController&) = delete;
+    
+    int start() {
+        if (stat_fd < 0) {
+            std::cerr << "[CPU-ADAPT] Cannot read cpu.stat, controller disabled" << std::endl;
             return -1;
         }
+        std::cout << "[CPU-ADAPT] Quota " << base_cores << "-" << max_cores << " cores, period "
+                  << period_min_us << "-" << period_max_us << "us, burst up to " << burst_max_cores
+                  << " cores" << std::endl;
+        return cgroup.set_cpu_max(quota_us(), period_us);
+    }
+    
+    void tick() {
+        if (stat_fd < 0) return;
         
-        fp = fopen(output_path.c_str(), "wb");
-        if (!fp) {
-            std::cerr << "Failed to create output file: " << output_path << std::endl;
-            curl_easy_cleanup(curl);
+        char buf[1024];
+        ssize_t n = pread(stat_fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0) return;
+        buf[n] = '\0';
+        
+        long long periods = 0, throttled = 0, usage = 0;
+        std::stringstream ss(buf);
+        std::string key;
+        long long value;
+        while (ss >> key >> value) {
+            if (key == "nr_periods") periods = value;
+            else if (key == "nr_throttled") throttled = value;
+            else if (key == "usage_usec") usage = value;
+        }
+        
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        long long now_us = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+        
+        if (last_periods < 0) {
+            remember(periods, throttled, usage, now_us);
+            return;
+        }
+        
+        long long d_periods = periods - last_periods;
+        long long d_throttled = throttled - last_throttled;
+        double used_cores = now_us > last_time_us ? (double)(usage - last_usage) / (now_us - last_time_us) : 0;
+        remember(periods, throttled, usage, now_us);
+        
+        // No periods elapsed: the container didn't run at all
+        if (d_periods <= 0) return;
+        double ratio = (double)d_throttled / d_periods;
+        
+        if (ratio > throttle_threshold) {
+            calm_ticks = 0;
+            escalate(ratio);
+        } else if (++calm_ticks >= calm_ticks_before_decay && used_cores < quota_cores * 0.5 &&
+                   (quota_cores > base_cores || period_us < period_max_us || burst_us > 0)) {
+            // Undo escalation a step at a time: quota, period and burst
+            calm_ticks = 0;
+            double old_quota = quota_cores;
+            long old_period = period_us, old_burst = burst_us;
+            if (apply(std::max(base_cores, quota_cores * 0.9), std::min(period_max_us, period_us * 2), burst_us / 2) == 0) {
+                std::cout << "[CPU-ADAPT] Idle at " << used_cores << " cores, quota " << old_quota
+                          << " -> " << quota_cores << " cores, period " << old_period << " -> " << period_us
+                          << "us, burst " << old_burst << " -> " << burst_us << "us" << std::endl;
+            }
+        }
+    }
+    
+private:
+    long quota_us() const {
+        return quota_for(quota_cores, period_us);
+    }
+    
+    static long quota_for(double cores, long period) {
+        return std::max(1000L, (long)(cores * period));
+    }
+    
+    // Writes a new quota, period and burst, keeping the old ones in the
+    // cgroup and in this object if any write fails. The kernel rejects a
+    // quota below the burst, so the burst is capped at the quota and a
+    // shrinking burst is written first.
+    int apply(double cores, long period, long burst) {
+        long quota = quota_for(cores, period);
+        burst = std::min(burst, quota);
+        bool burst_first = burst < burst_us;
+        if (burst_first && write_burst(burst) != 0) {
+            return -1;
+        }
+        if (cgroup.set_cpu_max(quota, period) != 0) {
+            if (burst_first) write_burst(burst_us);
+            return -1;
+        }
+        if (burst > burst_us && write_burst(burst) != 0) {
+            cgroup.set_cpu_max(quota_us(), period_us);
             return -1;
         }
+        quota_cores = cores;
+        period_us = period;
+        burst_us = burst;
+        return 0;
+    }
+    
+    int write_burst(long burst) {
+        if (!burst_supported) return -1;
+        if (cgroup.set_cpu_burst(burst) == 0) return 0;
+        if (errno == ENOENT) {
+            burst_supported = false;  // cpu.max.burst needs Linux 5.14+
+        }
+        return -1;
+    }
+    
+    void remember(long long periods, long long throttled, long long usage, long long now_us) {
+        last_periods = periods;
+        last_throttled = throttled;
+        last_usage = usage;
+        last_time_us = now_us;
+    }
+    
+    // One step per tick, cheapest first
+    void escalate(double ratio) {
+        int percent = (int)(ratio * 100);
+        
+        // Burst lets unused quota from quiet periods absorb short spikes
+        long burst_limit = std::min((long)(burst_max_cores * period_us), quota_us());
+        if (burst_supported && burst_us < burst_limit) {
+            long old_burst = burst_us;
+            if (apply(quota_cores, period_us, std::min(burst_limit, std::max(burst_us * 2, quota_us() / 2))) == 0) {
+                std::cout << "[CPU-ADAPT] Throttled in " << percent << "% of periods, burst "
+                          << old_burst << " -> " << burst_us << "us" << std::endl;
+                return;
+            }
+        }
         
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "iza-container-runtime/1.0");
+        // Shorter periods keep the same share but cap how long a throttled task stalls
+        if (period_us > period_min_us) {
+            long old_period = period_us;
+            long shorter = std::max(period_min_us, period_us / 2);
+            if (apply(quota_cores, shorter, std::min(burst_us, (long)(burst_max_cores * shorter))) == 0) {
+                std::cout << "[CPU-ADAPT] Throttled in " << percent << "% of periods, period "
+                          << old_period << " -> " << period_us << "us" << std::endl;
+                return;
+            }
+        }
         
-        res = curl_easy_perform(curl);
+        if (quota_cores < max_cores) {
+            double old_quota = quota_cores;
+            if (apply(std::min(max_cores, quota_cores * 1.25), period_us, burst_us) == 0) {
+                std::cout << "[CPU-ADAPT] Throttled in " << percent << "% of periods, quota "
+                          << old_quota << " -> " << quota_cores << " cores" << std::endl;
+            }
+        }
+    }
+};
+
+// Builds the --cpu-adapt controller, or nullptr when it wasn't requested
+std::unique_ptr<CpuQuotaController> make_cpu_controller(const Arguments& args, const std::string& cgroup_path) {
+    if (args.cpu_adapt.empty()) return nullptr;
+    
+    try {
+        double base = std::stod(args.cpu_limit);
+        double max = std::stod(args.cpu_adapt);
+        double burst = args.cpu_burst_max.empty() ? base : std::stod(args.cpu_burst_max);
         
-        fclose(fp);
-        curl_easy_cleanup(curl);
+        size_t colon = args.cpu_period_range.find(':');
+        long period_min = std::stol(args.cpu_period_range.substr(0, colon));
+        long period_max = colon == std::string::npos ? period_min : std::stol(args.cpu_period_range.substr(colon + 1));
         
-        if (res != CURLE_OK) {
-            std::cerr << "Download failed: " << curl_easy_strerror(res) << std::endl;
-            std::filesystem::remove(output_path);
+        // The kernel accepts periods between 1ms and 1s
+        if (base <= 0 || max < base || burst < 0 || period_min < 1000 ||
+            period_max > 1000000 || period_min > period_max) {
+            throw std::invalid_argument("out of range");
+        }
+        return std::make_unique<CpuQuotaController>(cgroup_path, base, max, burst, period_min, period_max);
+    } catch (const std::exception& e) {
+        std::cerr << "[CPU-ADAPT] Invalid bounds (--cpus " << args.cpu_limit << ", --cpu-adapt " << args.cpu_adapt
+                  << ", --cpu-period-range " << args.cpu_period_range << "), controller disabled" << std::endl;
+        return nullptr;
+    }
+}
+
+// Proactive reclaim for idle containers: once cpu.stat shows the container
+// barely running and its memory PSI is quiet, shrink it through memory.reclaim
+// one step per interval, so active containers find free memory instead of
+// stalling in reclaim themselves.
+class MemoryReclaimer {
+private:
+    CgroupManager cgroup;
+    long long step_bytes;               // Fixed step, or 0 to use step_percent
+    int step_percent;
+    int interval_ticks;
+    double idle_cores;
+    int stat_fd = -1;
+    int current_fd = -1;
+    int pressure_fd = -1;
+    long long last_usage = -1;
+    long long last_time_us = 0;
+    int idle_ticks = 0;
+    bool exhausted = false;             // Kernel found nothing more to reclaim this idle stretch
+    long long reclaimed = 0;            // During the current idle stretch
+    
+    static constexpr double pressure_limit = 1.0;  // memory "some avg10", percent
+    static constexpr long long min_step = 1024 * 1024;
+    
+public:
+    MemoryReclaimer(const std::string& cgroup_path, long long bytes, int percent, int interval, double idle)
+        : cgroup(cgroup_path), step_bytes(bytes), step_percent(percent), interval_ticks(interval), idle_cores(idle) {
+        stat_fd = open((cgroup_path + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC);
+        current_fd = open((cgroup_path + "/memory.current").c_str(), O_RDONLY | O_CLOEXEC);
+        pressure_fd = open((cgroup_path + "/memory.pressure").c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    
+    ~MemoryReclaimer() {
+        for (int fd : {stat_fd, current_fd, pressure_fd}) {
+            if (fd >= 0) close(fd);
+        }
+    }
+    
+    MemoryReclaimer(const MemoryReclaimer&) = delete;
+    MemoryReclaimer& operator=(const MemoryReclaimer&) = delete;
+    
+    int start() {
+        if (stat_fd < 0 || current_fd < 0 || !std::filesystem::exists(cgroup.path() + "/memory.reclaim")) {
+            std::cerr << "[RECLAIM] memory.reclaim unavailable (needs Linux 5.19+ and the memory controller), "
+                      << "idle reclaim disabled" << std::endl;
             return -1;
         }
-        
-        std::cout << "[DOWNLOAD] Downloaded to: " << output_path << std::endl;
+        std::cout << "[RECLAIM] Reclaiming " << (step_bytes > 0 ? format_bytes(step_bytes) : std::to_string(step_percent) + "%")
+                  << " every " << interval_ticks << "s while below " << idle_cores * 100 << "% CPU" << std::endl;
         return 0;
     }
     
-    int extract_image(const std::string& archive_path, const std::string& extract_dir) {
-        std::cout << "[EXTRACT] Extracting to: " << extract_dir << std::endl;
+    void tick() {
+        long long usage = read_key(stat_fd, "usage_usec");
+        if (usage < 0) return;
         
-        // Remove existing directory
-        std::filesystem::remove_all(extract_dir);
+        long long now_us = ContainerSupervisor::monotonic_ms() * 1000;
+        if (last_usage < 0) {
+            last_usage = usage;
+            last_time_us = now_us;
+            return;
+        }
         
-        // Create directories
-        std::filesystem::create_directories(extract_dir);
-        std::string rootfs_dir = extract_dir + "/rootfs";
-        std::filesystem::create_directories(rootfs_dir);
+        double used_cores = now_us > last_time_us ? (double)(usage - last_usage) / (now_us - last_time_us) : 0;
+        last_usage = usage;
+        last_time_us = now_us;
         
-        struct archive *a;
-        struct archive *ext;
-        struct archive_entry *entry;
-        int flags;
-        int r;
+        // Stalling on memory while not using CPU is a container waiting on
+        // reclaim or refaults; taking more would make that worse
+        double stall = memory_stall();
+        if (used_cores > idle_cores || stall > pressure_limit) {
+            if (reclaimed > 0) {
+                std::cout << "[RECLAIM] Active again after reclaiming " << format_bytes(reclaimed) << std::endl;
+            }
+            idle_ticks = 0;
+            exhausted = false;
+            reclaimed = 0;
+            return;
+        }
         
-        // Select which attributes we want to restore.
-        flags = ARCHIVE_EXTRACT_TIME;
-        flags |= ARCHIVE_EXTRACT_PERM;
-        flags |= ARCHIVE_EXTRACT_ACL;
-        flags |= ARCHIVE_EXTRACT_FFLAGS;
+        if (++idle_ticks % interval_ticks != 0 || exhausted) return;
         
-        a = archive_read_new();
-        archive_read_support_format_all(a);
-        archive_read_support_filter_all(a);
-        ext = archive_write_disk_new();
-        archive_write_disk_set_options(ext, flags);
-        archive_write_disk_set_standard_lookup(ext);
+        long long before = read_key(current_fd, "");
+        long long amount = step_bytes > 0 ? step_bytes : before * step_percent / 100;
+        amount = std::max(amount, min_step);
         
-        if ((r = archive_read_open_filename(a, archive_path.c_str(), 10240))) {
-            std::cerr << "Failed to open archive: " << archive_error_string(a) << std::endl;
-            archive_read_free(a);
-            archive_write_free(ext);
-            return -1;
+        if (cgroup.reclaim_memory(amount) != 0) {
+            if (errno != EAGAIN) {
+                std::cerr << "[RECLAIM] Writing memory.reclaim failed: " << strerror(errno) << std::endl;
+            }
+            // Either way there is nothing more to take until the container runs again
+            exhausted = true;
         }
         
-        for (;;) {
-            r = archive_read_next_header(a, &entry);
-            if (r == ARCHIVE_EOF)
-                break;
-            if (r < ARCHIVE_OK)
-                std::cerr << archive_error_string(a) << std::endl;
-            if (r < ARCHIVE_WARN) {
-                archive_read_free(a);
-                archive_write_free(ext);
-                return -1;
-            }
-            
-            // Modify the pathname to extract into our rootfs directory
-            const char* current_file = archive_entry_pathname(entry);
-            std::string new_path = rootfs_dir + "/" + current_file;
-            archive_entry_set_pathname(entry, new_path.c_str());
-            
-            r = archive_write_header(ext, entry);
-            if (r < ARCHIVE_OK)
-                std::cerr << archive_error_string(ext) << std::endl;
-            else if (archive_entry_size(entry) > 0) {
-                r = copy_data(a, ext);
-                if (r < ARCHIVE_OK)
-                    std::cerr << archive_error_string(ext) << std::endl;
-                if (r < ARCHIVE_WARN) {
-                    archive_read_free(a);
-                    archive_write_free(ext);
-                    return -1;
-                }
-            }
-            r = archive_write_finish_entry(ext);
-            if (r < ARCHIVE_OK)
-                std::cerr << archive_error_string(ext) << std::endl;
-            if (r < ARCHIVE_WARN) {
-                archive_read_free(a);
-                archive_write_free(ext);
-                return -1;
-            }
+        long long after = read_key(current_fd, "");
+        if (before > after) {
+            reclaimed += before - after;
+            std::cout << "[RECLAIM] Idle " << idle_ticks << "s, memory.current " << format_bytes(before)
+                      << " -> " << format_bytes(after) << std::endl;
         }
+    }
+    
+private:
+    // Value of KEY in a "key value" file, or the first number when KEY is empty
+    long long read_key(int fd, const std::string& key) {
+        char buf[1024];
+        ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0) return -1;
+        buf[n] = '\0';
         
-        archive_read_close(a);
-        archive_read_free(a);
-        archive_write_close(ext);
-        archive_write_free(ext);
+        std::stringstream ss(buf);
+        if (key.empty()) {
+            long long value;
+            return ss >> value ? value : -1;
+        }
         
-        std::cout << "[EXTRACT] Extraction complete" << std::endl;
-        return 0;
+        std::string name;
+        long long value;
+        while (ss >> name >> value) {
+            if (name == key) return value;
+        }
+        return -1;
     }
     
-    static int copy_data(struct archive *ar, struct archive *aw) {
-        int r;
-        const void *buff;
-        size_t size;
-        la_int64_t offset;
+    // "some avg10" from memory.pressure; 0 without PSI
+    double memory_stall() {
+        if (pressure_fd < 0) return 0;
         
-        for (;;) {
-            r = archive_read_data_block(ar, &buff, &size, &offset);
-            if (r == ARCHIVE_EOF)
-                return (ARCHIVE_OK);
-            if (r < ARCHIVE_OK)
-                return (r);
-            r = archive_write_data_block(aw, buff, size, offset);
-            if (r < ARCHIVE_OK) {
-                std::cerr << archive_error_string(aw) << std::endl;
-                return (r);
-            }
-        }
+        char buf[256];
+        ssize_t n = pread(pressure_fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0) return 0;
+        buf[n] = '\0';
+        
+        double avg10 = 0;
+        sscanf(buf, "some avg10=%lf", &avg10);
+        return avg10;
     }
 };
 
-class OverlayFS {
-private:
-    std::string overlay_dir = "/var/lib/iza/overlay";
-    bool overlay_supported = false;
+// Builds the --reclaim-idle policy, or nullptr when it wasn't requested
+std::unique_ptr<MemoryReclaimer> make_memory_reclaimer(const Arguments& args, CgroupManager& cgroup) {
+    if (args.reclaim_step.empty()) return nullptr;
     
-public:
-    OverlayFS() {
-        std::filesystem::create_directories(overlay_dir);
-        
-        // Check if OverlayFS is supported
-        std::ifstream filesystems("/proc/filesystems");
-        std::string line;
-        while (std::getline(filesystems, line)) {
-            if (line.find("overlay") != std::string::npos) {
-                overlay_supported = true;
-                break;
-            }
+    try {
+        long long bytes = 0;
+        int percent = 0;
+        if (args.reclaim_step.ends_with("%")) {
+            percent = std::stoi(args.reclaim_step.substr(0, args.reclaim_step.size() - 1));
+            if (percent <= 0 || percent > 100) throw std::invalid_argument("out of range");
+        } else {
+            bytes = cgroup.limit_bytes(args.reclaim_step);
+            if (bytes <= 0) throw std::invalid_argument("bad size");
         }
-    }
-    
-    int setup_overlay(const std::string& image_rootfs, const std::string& container_id, std::string& merged_dir) {
-        // Create directories for this container
-        std::string container_overlay = overlay_dir + "/" + container_id;
-        std::string upper_dir = container_overlay + "/upper";
-        std::string work_dir = container_overlay + "/work";
-        merged_dir = container_overlay + "/merged";
-        
-        // Clean up any existing overlay
-        cleanup_overlay(container_id);
         
-        // Create directories
-        std::filesystem::create_directories(upper_dir);
-        std::filesystem::create_directories(work_dir);
-        std::filesystem::create_directories(merged_dir);
+        int interval = std::stoi(args.reclaim_interval);
+        double idle_percent = std::stod(args.idle_threshold);
+        if (interval <= 0 || idle_percent < 0) throw std::invalid_argument("out of range");
         
-        if (overlay_supported) {
-            // Try OverlayFS first
-            std::string mount_opts = "lowerdir=" + image_rootfs +
-                                  ",upperdir=" + upper_dir +
-                                  ",workdir=" + work_dir;
-            
-            std::cout << "[OVERLAY] Mounting overlay: " << mount_opts << std::endl;
-            
-            if (mount("overlay", merged_dir.c_str(), "overlay", 0, mount_opts.c_str()) == 0) {
-                return 0; // Success!
+        return std::make_unique<MemoryReclaimer>(cgroup.path(), bytes, percent, interval, idle_percent / 100);
+    } catch (const std::exception& e) {
+        std::cerr << "[RECLAIM] Invalid settings (--reclaim-idle " << args.reclaim_step << ", --reclaim-interval "
+                  << args.reclaim_interval << ", --idle-threshold " << args.idle_threshold
+                  << "), idle reclaim disabled" << std::endl;
+        return nullptr;
+    }
+}
+
+// "iza stats": samples every running container (or one) each interval
+int stats_command(const Arguments& args) {
+    ContainerRegistry registry;
+    std::map<std::string, std::unique_ptr<CgroupStats>> open_stats;
+    std::map<std::string, CgroupSample> previous;
+    std::map<std::string, std::unique_ptr<CgroupPerfCounters>> open_perf;
+    std::map<std::string, PerfSample> previous_perf;
+    bool json = args.output_format == "json";
+    bool tty = isatty(STDOUT_FILENO);
+    
+    int interval_ms = 1000;
+    try {
+        interval_ms = (int)(std::stod(args.stats_interval) * 1000);
+    } catch (const std::exception& e) {
+        interval_ms = 0;
+    }
+    if (interval_ms <= 0) {
+        std::cerr << "Error: Invalid interval '" << args.stats_interval << "'" << std::endl;
+        return 1;
+    }
+    
+    // Listing parses every state file, so it runs again only when a
+    // container's cgroup is gone, and every RELIST_MS for new containers
+    const long long RELIST_MS = 5000;
+    std::vector<ContainerRecord> records;
+    long long listed_ms = 0;
+    bool relist = true;
+    
+    // The first pass only primes CPU deltas; output starts with the second
+    for (int pass = 0; ; pass++) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        long long now_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+        if (relist || now_ms - listed_ms >= RELIST_MS) {
+            records.clear();
+            if (!args.container_id.empty()) {
+                ContainerRecord record;
+                if (registry.find(args.container_id, record) != 0) {
+                    return pass == 0 ? 1 : 0;
+                }
+                records.push_back(record);
             } else {
-                std::cout << "[WARNING] OverlayFS mount failed, falling back to copy method" << std::endl;
+                records = registry.list();
             }
-        } else {
-            std::cout << "[WARNING] OverlayFS not available, using copy fallback" << std::endl;
+            listed_ms = now_ms;
+            relist = false;
         }
         
-        // Fallback: Copy the entire rootfs
-        std::cout << "[FALLBACK] Copying rootfs from " << image_rootfs << " to " << merged_dir << std::endl;
-        
-        // Verify source exists
-        std::cout << "[FALLBACK] Verifying source exists: " << image_rootfs << std::endl;
-        if (!std::filesystem::exists(image_rootfs)) {
-            std::cerr << "[FALLBACK] Source directory does not exist!" << std::endl;
-            return -1;
+        if (pass > 0 && !json) {
+            if (tty && !args.no_stream) {
+                std::cout << "\033[2J\033[H";
+            }
+            printf("%-28s %8s %24s %7s %6s %21s",
+                   "CONTAINER ID", "CPU %", "MEM USAGE / LIMIT", "MEM %", "PIDS", "BLOCK I/O");
+            if (args.perf) {
+                printf(" %6s %8s %10s %10s", "IPC", "MISS %", "CTX-SW/s", "FAULTS/s");
+            }
+            printf("\n");
         }
         
-        try {
-            // Use filesystem::copy to recursively copy the entire directory
-            std::filesystem::copy(image_rootfs, merged_dir,
-                std::filesystem::copy_options::recursive |
-                std::filesystem::copy_options::copy_symlinks);
+        std::map<std::string, bool> seen;
+        for (const auto& record : records) {
+            if (record.cgroup_path.empty()) continue;
+            seen[record.id] = true;
             
-            std::cout << "[FALLBACK] Copy completed successfully" << std::endl;
-            return 0;
-        } catch (const std::exception& e) {
-            std::cerr << "[FALLBACK] Copy failed: " << e.what() << std::endl;
-            std::filesystem::remove_all(container_overlay);
-            return -1;
+            auto& stats = open_stats[record.id];
+            if (!stats) {
+                stats = std::make_unique<CgroupStats>(record.cgroup_path);
+            }
+            
+            CgroupSample current;
+            if (!stats->is_open() || stats->sample(current) != 0) {
+                // Its cgroup just went away, so the registry has changed
+                if (previous.erase(record.id)) relist = true;
+                continue;
+            }
+            
+            PerfSample perf;
+            if (args.perf) {
+                auto& counters = open_perf[record.id];
+                if (!counters) {
+                    CgroupManager cgroup(record.cgroup_path);
+                    counters = std::make_unique<CgroupPerfCounters>(cgroup);
+                }
+                counters->sample(perf);
+            }
+            
+            auto prev = previous.find(record.id);
+            if (pass > 0 && prev != previous.end()) {
+                long long wall = current.timestamp_usec - prev->second.timestamp_usec;
+                double cpu_percent = wall > 0 ?
+                    100.0 * (current.cpu_usage_usec - prev->second.cpu_usage_usec) / wall : 0.0;
+                double mem_percent = current.memory_max > 0 ?
+                    100.0 * current.memory_current / current.memory_max : 0.0;
+                
+                // Per-interval perf deltas; "-" / null where there is no PMU
+                const PerfSample& last = previous_perf[record.id];
+                double seconds = wall > 0 ? wall / 1e6 : 1.0;
+                long long cycles = perf.cycles - last.cycles;
+                long long instructions = perf.instructions - last.instructions;
+                long long references = perf.cache_references - last.cache_references;
+                long long misses = perf.cache_misses - last.cache_misses;
+                char ipc[16] = "-", miss_rate[16] = "-";
+                if (perf.hardware && cycles > 0) {
+                    snprintf(ipc, sizeof(ipc), "%.2f", (double)instructions / cycles);
+                }
+                if (perf.hardware && references > 0) {
+                    snprintf(miss_rate, sizeof(miss_rate), "%.2f%%", 100.0 * misses / references);
+                }
+                char switch_rate[16] = "-", fault_rate[16] = "-";
+                if (perf.software) {
+                    snprintf(switch_rate, sizeof(switch_rate), "%.0f", (perf.context_switches - last.context_switches) / seconds);
+                    snprintf(fault_rate, sizeof(fault_rate), "%.0f", (perf.page_faults - last.page_faults) / seconds);
+                }
+                
+                if (json) {
+                    printf("{\"id\":\"%s\",\"pid\":%d,\"cpu_percent\":%.2f,\"cpu_usage_usec\":%lld,"
+                           "\"memory_current\":%lld,\"memory_max\":%lld,\"memory_anon\":%lld,\"memory_file\":%lld,"
+                           "\"pids_current\":%lld,\"io_read_bytes\":%lld,\"io_write_bytes\":%lld",
+                           record.id.c_str(), record.container_pid, cpu_percent, current.cpu_usage_usec,
+                           current.memory_current, current.memory_max, current.memory_anon, current.memory_file,
+                           current.pids_current, current.io_read_bytes, current.io_write_bytes);
+                    if (args.perf) {
+                        if (perf.software) {
+                            printf(",\"context_switches\":%lld,\"page_faults\":%lld",
+                                   perf.context_switches - last.context_switches, perf.page_faults - last.page_faults);
+                        } else {
+                            printf(",\"context_switches\":null,\"page_faults\":null");
+                        }
+                        if (perf.hardware) {
+                            printf(",\"cycles\":%lld,\"instructions\":%lld,\"cache_references\":%lld,\"cache_misses\":%lld,"
+                                   "\"ipc\":%.3f,\"cache_miss_percent\":%.2f",
+                                   cycles, instructions, references, misses,
+                                   cycles > 0 ? (double)instructions / cycles : 0.0,
+                                   references > 0 ? 100.0 * misses / references : 0.0);
+                        } else {
+                            printf(",\"cycles\":null,\"instructions\":null,\"cache_references\":null,"
+                                   "\"cache_misses\":null,\"ipc\":null,\"cache_miss_percent\":null");
+                        }
+                    }
+                    printf("}\n");
+                } else {
+                    std::string mem = current.memory_current < 0 ? "-" :
+                                      format_bytes(current.memory_current) + " / " +
+                                      (current.memory_max > 0 ? format_bytes(current.memory_max) : "unlimited");
+                    std::string io = format_bytes(current.io_read_bytes) + " / " + format_bytes(current.io_write_bytes);
+                    std::string pids = current.pids_current >= 0 ? std::to_string(current.pids_current) : "-";
+                    printf("%-28s %7.2f%% %24s %6.2f%% %6s %21s",
+                           record.id.c_str(), cpu_percent, mem.c_str(), mem_percent, pids.c_str(), io.c_str());
+                    if (args.perf) {
+                        printf(" %6s %8s %10s %10s", ipc, miss_rate, switch_rate, fault_rate);
+                    }
+                    printf("\n");
+                }
+            }
+            previous[record.id] = current;
+            previous_perf[record.id] = perf;
         }
-    }
-    
-    int cleanup_overlay(const std::string& container_id) {
-        std::string container_overlay = overlay_dir + "/" + container_id;
-        std::string merged_dir = container_overlay + "/merged";
         
-        // Unmount if it was mounted with OverlayFS
-        if (std::filesystem::exists(merged_dir)) {
-            if (umount(merged_dir.c_str()) != 0) {
-                // It's OK if this fails - might not be mounted or might be a copy
+        // Drop fds of containers that have exited
+        for (auto it = open_stats.begin(); it != open_stats.end();) {
+            if (!seen.count(it->first)) {
+                previous.erase(it->first);
+                previous_perf.erase(it->first);
+                open_perf.erase(it->first);
+                it = open_stats.erase(it);
+            } else {
+                ++it;
             }
         }
         
-        // Remove the entire container overlay directory
-        try {
-            std::filesystem::remove_all(container_overlay);
-        } catch (const std::exception& e) {
-            std::cout << "[CLEANUP] Note: " << e.what() << std::endl;
-        }
-        return 0;
+        std::cout << std::flush;
+        if (pass > 0 && args.no_stream) break;
+        usleep(interval_ms * 1000);
     }
+    
+    return 0;
+}
+
+// What the dynamic loader needs to start a 64-bit ELF binary
+struct ElfInfo {
+    uint16_t machine = 0;
+    std::string interpreter;            // PT_INTERP, e.g. /lib64/ld-linux-x86-64.so.2
+    std::vector<std::string> needed;    // DT_NEEDED sonames
+    std::vector<std::string> runpath;   // DT_RUNPATH, or DT_RPATH when there is none
 };
 
-class CgroupManager {
-private:
-    std::string cgroup_name;
-    std::string cgroup_path;
-    bool created = false;
+// Reads PT_INTERP and the dynamic section straight from the file. Returns -1
+// for anything that isn't a little-endian ELF64 file; static binaries
+// succeed with no interpreter and no dependencies.
+int read_elf_info(const std::string& path, ElfInfo& info) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
     
-public:
-    CgroupManager() {
-        // Generate unique cgroup name
-        cgroup_name = "iza-" + std::to_string(getpid()) + "-" + std::to_string(time(nullptr));
-        cgroup_path = "/sys/fs/cgroup/" + cgroup_name;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return -1;
     }
+    size_t size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
     
-    ~CgroupManager() {
-        cleanup();
+    const unsigned char* base = static_cast<const unsigned char*>(map);
+    auto in_file = [size](uint64_t offset, uint64_t len) {
+        return offset <= size && len <= size - offset;
+    };
+    
+    const Elf64_Ehdr* ehdr = reinterpret_cast<const Elf64_Ehdr*>(base);
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_ident[EI_DATA] != ELFDATA2LSB || ehdr->e_phentsize != sizeof(Elf64_Phdr) ||
+        !in_file(ehdr->e_phoff, (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr))) {
+        munmap(map, size);
+        return -1;
     }
+    info.machine = ehdr->e_machine;
     
-    int create_cgroup() {
-        std::cout << "[CGROUP] Creating: " << cgroup_path << std::endl;
+    const Elf64_Phdr* phdrs = reinterpret_cast<const Elf64_Phdr*>(base + ehdr->e_phoff);
+    const Elf64_Phdr* dynamic = nullptr;
+    for (int i = 0; i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_type == PT_INTERP && in_file(phdrs[i].p_offset, phdrs[i].p_filesz)) {
+            info.interpreter = std::string(reinterpret_cast<const char*>(base + phdrs[i].p_offset),
+                                           strnlen(reinterpret_cast<const char*>(base + phdrs[i].p_offset), phdrs[i].p_filesz));
+        } else if (phdrs[i].p_type == PT_DYNAMIC && in_file(phdrs[i].p_offset, phdrs[i].p_filesz)) {
+            dynamic = &phdrs[i];
+        }
+    }
+    
+    // Dynamic entries hold virtual addresses; PT_LOAD maps them back to file offsets
+    auto file_offset = [&](uint64_t vaddr, uint64_t& offset) {
+        for (int i = 0; i < ehdr->e_phnum; i++) {
+            if (phdrs[i].p_type == PT_LOAD && vaddr >= phdrs[i].p_vaddr &&
+                vaddr < phdrs[i].p_vaddr + phdrs[i].p_filesz) {
+                offset = vaddr - phdrs[i].p_vaddr + phdrs[i].p_offset;
+                return true;
+            }
+        }
+        return false;
+    };
+    
+    if (dynamic) {
+        const Elf64_Dyn* dyn = reinterpret_cast<const Elf64_Dyn*>(base + dynamic->p_offset);
+        size_t count = dynamic->p_filesz / sizeof(Elf64_Dyn);
         
-        // Check if cgroups v2 is available
-        if (!std::filesystem::exists("/sys/fs/cgroup/cgroup.controllers")) {
-            std::cerr << "Error: cgroups v2 not available" << std::endl;
-            return -1;
+        uint64_t strtab = 0, strsz = 0;
+        for (size_t i = 0; i < count && dyn[i].d_tag != DT_NULL; i++) {
+            if (dyn[i].d_tag == DT_STRTAB) strtab = dyn[i].d_un.d_ptr;
+            else if (dyn[i].d_tag == DT_STRSZ) strsz = dyn[i].d_un.d_val;
+        }
+        
+        uint64_t strtab_offset;
+        if (strtab && file_offset(strtab, strtab_offset) && in_file(strtab_offset, strsz)) {
+            const char* strings = reinterpret_cast<const char*>(base + strtab_offset);
+            auto string_at = [&](uint64_t index) {
+                return index < strsz ? std::string(strings + index, strnlen(strings + index, strsz - index)) : std::string();
+            };
+            
+            std::vector<std::string> rpath;
+            for (size_t i = 0; i < count && dyn[i].d_tag != DT_NULL; i++) {
+                if (dyn[i].d_tag == DT_NEEDED) {
+                    info.needed.push_back(string_at(dyn[i].d_un.d_val));
+                } else if (dyn[i].d_tag == DT_RUNPATH || dyn[i].d_tag == DT_RPATH) {
+                    std::stringstream dirs(string_at(dyn[i].d_un.d_val));
+                    std::string dir;
+                    auto& target = dyn[i].d_tag == DT_RUNPATH ? info.runpath : rpath;
+                    while (std::getline(dirs, dir, ':')) {
+                        if (!dir.empty()) target.push_back(dir);
+                    }
+                }
+            }
+            if (info.runpath.empty()) info.runpath = rpath;
+        }
+    }
+    
+    munmap(map, size);
+    return 0;
+}
+
+// Library directories the loader searches after RUNPATH: /etc/ld.so.conf
+// (one level of "include" globs) and the built-in defaults
+std::vector<std::string> library_search_dirs() {
+    std::vector<std::string> dirs;
+    
+    std::function<void(const std::string&, int)> read_conf = [&](const std::string& file, int depth) {
+        std::ifstream in(file);
+        std::string line;
+        while (std::getline(in, line)) {
+            line = line.substr(0, line.find('#'));
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t") + 1);
+            if (line.empty()) continue;
+            
+            if (line.starts_with("include ") && depth == 0) {
+                std::filesystem::path pattern = line.substr(8);
+                std::error_code ec;
+                std::vector<std::string> confs;
+                for (const auto& entry : std::filesystem::directory_iterator(pattern.parent_path(), ec)) {
+                    if (entry.path().extension() == pattern.extension()) confs.push_back(entry.path());
+                }
+                std::sort(confs.begin(), confs.end());
+                for (const auto& conf : confs) {
+                    read_conf(conf, depth + 1);
+                }
+            } else if (line.starts_with("/")) {
+                dirs.push_back(line);
+            }
         }
+    };
+    read_conf("/etc/ld.so.conf", 0);
+    
+    for (const char* dir : {"/lib64", "/usr/lib64", "/lib", "/usr/lib"}) {
+        dirs.push_back(dir);
+    }
+    return dirs;
+}
+
+// Host paths of BINARIES plus everything the loader will open to run them:
+// the interpreter and the transitive DT_NEEDED closure
+std::vector<std::string> elf_closure(const std::vector<std::string>& binaries) {
+    std::vector<std::string> search_dirs = library_search_dirs();
+    std::vector<std::string> result;
+    std::set<std::string> seen;
+    std::vector<std::string> pending(binaries.begin(), binaries.end());
+    uint16_t machine = 0;
+    
+    while (!pending.empty()) {
+        std::string path = pending.back();
+        pending.pop_back();
+        if (!seen.insert(path).second) continue;
         
-        // Create cgroup directory
-        if (mkdir(cgroup_path.c_str(), 0755) != 0) {
-            perror("Failed to create cgroup directory");
-            return -1;
+        ElfInfo info;
+        if (read_elf_info(path, info) != 0) {
+            // Scripts and non-ELF files are placed as they are
+            result.push_back(path);
+            continue;
         }
+        if (machine == 0) machine = info.machine;
+        result.push_back(path);
         
-        created = true;
+        if (!info.interpreter.empty()) pending.push_back(info.interpreter);
         
-        // Enable controllers we need
-        std::string controllers_file = cgroup_path + "/cgroup.subtree_control";
-        std::ofstream controllers(controllers_file);
-        if (controllers.is_open()) {
-            controllers << "+memory +cpu";
-            controllers.close();
+        std::string origin = std::filesystem::path(path).parent_path();
+        for (const auto& soname : info.needed) {
+            if (soname.find('/') != std::string::npos) {
+                pending.push_back(soname);
+                continue;
+            }
+            
+            std::vector<std::string> dirs;
+            for (std::string dir : info.runpath) {
+                size_t pos = dir.find("$ORIGIN");
+                if (pos != std::string::npos) dir.replace(pos, 7, origin);
+                dirs.push_back(dir);
+            }
+            dirs.insert(dirs.end(), search_dirs.begin(), search_dirs.end());
+            
+            bool found = false;
+            for (const auto& dir : dirs) {
+                std::string candidate = dir + "/" + soname;
+                ElfInfo lib;
+                // Skip same-named libraries of another architecture (e.g. /usr/lib32)
+                if (read_elf_info(candidate, lib) == 0 && lib.machine == machine) {
+                    pending.push_back(candidate);
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                std::cerr << "[LEGACY] Warning: " << soname << " (needed by " << path << ") not found" << std::endl;
+            }
         }
-        
-        return 0;
     }
+    return result;
+}
+
+// Puts host file PATH at the same path under ROOTFS. Symlinks are recreated and
+// followed; files are hard-linked so the container shares the host's page
+// cache, or copied when the rootfs is on another filesystem.
+int place_host_file(const std::string& path, const std::string& rootfs, int depth = 0) {
+    std::filesystem::path target = rootfs + path;
+    std::error_code ec;
+    if (std::filesystem::symlink_status(target, ec).type() != std::filesystem::file_type::not_found) return 0;
+    std::filesystem::create_directories(target.parent_path(), ec);
     
-    int set_memory_limit(const std::string& limit) {
-        if (!created) return -1;
+    if (std::filesystem::is_symlink(path, ec)) {
+        auto link = std::filesystem::read_symlink(path, ec);
+        if (ec || depth > 8) return -1;
+        std::filesystem::create_symlink(link, target, ec);
+        if (ec) return -1;
         
-        long long bytes = parse_memory_limit(limit);
-        if (bytes <= 0) return -1;
-        
-        std::string memory_max_file = cgroup_path + "/memory.max";
-        std::ofstream memory_file(memory_max_file);
-        if (!memory_file.is_open()) {
-            perror("Failed to set memory limit");
-            return -1;
-        }
-        
-        memory_file << bytes;
-        memory_file.close();
-        
-        std::cout << "[CGROUP] Memory limit: " << limit << " (" << bytes << " bytes)" << std::endl;
-        return 0;
+        std::filesystem::path resolved = link.is_absolute() ? link : std::filesystem::path(path).parent_path() / link;
+        return place_host_file(resolved.lexically_normal(), rootfs, depth + 1);
     }
     
-    int set_cpu_limit(const std::string& limit) {
-        if (!created) return -1;
-        
-        double cpu_cores = std::stod(limit);
-        if (cpu_cores <= 0) return -1;
-        
-        int period = 100000;
-        int quota = (int)(cpu_cores * period);
-        
-        std::string cpu_max_file = cgroup_path + "/cpu.max";
-        std::ofstream cpu_file(cpu_max_file);
-        if (!cpu_file.is_open()) {
-            perror("Failed to set CPU limit");
-            return -1;
+    if (link(path.c_str(), target.c_str()) == 0) return 0;
+    
+    // EXDEV: another filesystem; EPERM: fs.protected_hardlinks on files we don't own
+    std::filesystem::copy_file(path, target, ec);
+    if (ec) {
+        std::cerr << "[LEGACY] Failed to place " << path << ": " << ec.message() << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// The legacy rootfs: a few host binaries and /etc/hostname
+const std::vector<std::string> legacy_dirs = {
+    "/bin", "/usr", "/usr/bin", "/etc", "/proc", "/tmp", "/dev", "/dev/shm",
+    "/lib", "/lib64", "/lib/x86_64-linux-gnu", "/usr/lib", "/usr/lib/x86_64-linux-gnu"
+};
+const std::vector<std::string> legacy_binaries = {
+    "/bin/bash",
+    "/bin/ls",
+    "/bin/ps",
+    "/usr/bin/whoami",
+    "/bin/cat",
+    "/usr/bin/stress",
+    "/bin/sh",
+    "/bin/hostname"
+};
+const std::string legacy_cache_dir = iza_storage_root() + "/legacy";
+
+// Host files that make up the legacy rootfs: the binaries and their library closure
+std::vector<std::string> legacy_rootfs_files() {
+    std::vector<std::string> binaries;
+    for (const auto& binary : legacy_binaries) {
+        if (std::filesystem::exists(binary)) binaries.push_back(binary);
+    }
+    return elf_closure(binaries);
+}
+
+// Hash of the path, size and mtime of everything that goes into the legacy
+// rootfs, so a host upgrade of any binary or library produces a new tree
+// instead of a stale one without reading every file on each run
+std::string legacy_rootfs_digest(const std::vector<std::string>& files) {
+    Sha256 hash;
+    hash.update(std::string("iza-legacy-rootfs-v3\n"));
+    for (const auto& dir : legacy_dirs) {
+        hash.update("dir " + dir + "\n");
+    }
+    for (const auto& file : files) {
+        struct stat st;
+        if (stat(file.c_str(), &st) != 0) {
+            hash.update("missing " + file + "\n");
+            continue;
         }
-        
-        cpu_file << quota << " " << period;
-        cpu_file.close();
-        
-        std::cout << "[CGROUP] CPU limit: " << limit << " cores" << std::endl;
+        hash.update("file " + file + " " + std::to_string(st.st_size) + " " + std::to_string(st.st_mtim.tv_sec) +
+                    "." + std::to_string(st.st_mtim.tv_nsec) + "\n");
+    }
+    return hash.hex_digest();
+}
+
+int build_legacy_rootfs(const std::string& rootfs, const std::vector<std::string>& files) {
+    for (const auto& dir : legacy_dirs) {
+        std::filesystem::create_directories(rootfs + dir);
+    }
+    
+    for (const auto& file : files) {
+        if (place_host_file(file, rootfs) != 0) return -1;
+    }
+    
+    std::ofstream hostname(rootfs + "/etc/hostname");
+    hostname << "iza-container" << std::endl;
+    hostname.close();
+    return hostname.fail() ? -1 : 0;
+}
+
+// Legacy container filesystem setup (for backward compatibility)
+// Returns the shared, read-only legacy rootfs in ROOTFS, building it on first
+// use. Each container gets its own overlay on top, so concurrent runs never
+// touch the same files.
+int setup_legacy_filesystem(std::string& rootfs) {
+    std::vector<std::string> files = legacy_rootfs_files();
+    std::string digest = legacy_rootfs_digest(files);
+    std::string cached = legacy_cache_dir + "/" + digest;
+    rootfs = cached + "/rootfs";
+    
+    if (std::filesystem::exists(rootfs)) {
+        std::cout << "[LEGACY] Using cached rootfs " << digest.substr(0, 12) << std::endl;
         return 0;
     }
     
-    int add_process(pid_t pid) {
-        if (!created) return -1;
-        
-        std::string procs_file = cgroup_path + "/cgroup.procs";
-        std::ofstream procs(procs_file);
-        if (!procs.is_open()) {
-            perror("Failed to add process to cgroup");
+    std::cout << "[LEGACY] Building rootfs " << digest.substr(0, 12) << std::endl;
+    std::filesystem::create_directories(legacy_cache_dir);
+    
+    // Build next to the cache and rename into place, so a half-built tree is never visible
+    std::string staging = legacy_cache_dir + "/.tmp-" + std::to_string(getpid());
+    std::filesystem::remove_all(staging);
+    if (build_legacy_rootfs(staging + "/rootfs", files) != 0) {
+        std::filesystem::remove_all(staging);
+        return -1;
+    }
+    
+    if (rename(staging.c_str(), cached.c_str()) != 0) {
+        std::filesystem::remove_all(staging);
+        // Another run built the same digest first; theirs is identical
+        if (errno != EEXIST && errno != ENOTEMPTY) {
+            perror("Failed to publish legacy rootfs");
             return -1;
         }
-        
-        procs << pid;
-        procs.close();
-        
+    }
+    return 0;
+}
+
+// A tmpfs with OPTIONS, plus huge=HUGE if given. Kernels built without
+// shmem THP reject huge= with EINVAL; the mount is retried without it.
+int mount_tmpfs(const std::string& target, unsigned long flags, const std::string& options, const std::string& huge) {
+    std::string with_huge = huge.empty() ? options : options + ",huge=" + huge;
+    if (mount("tmpfs", target.c_str(), "tmpfs", flags, with_huge.c_str()) == 0) {
         return 0;
     }
-    
-    void cleanup() {
-        if (!created) return;
-        
-        if (rmdir(cgroup_path.c_str()) != 0) {
-            // It's OK if this fails
+    if (!huge.empty() && errno == EINVAL &&
+        mount("tmpfs", target.c_str(), "tmpfs", flags, options.c_str()) == 0) {
+        std::cout << "[CHILD] Huge pages unsupported for tmpfs, mounted " << target << " without" << std::endl;
+        return 0;
+    }
+    perror(("Failed to mount tmpfs on " + target).c_str());
+    return -1;
+}
+
+void close_fds(const std::vector<int>& fds) {
+    for (int fd : fds) {
+        close(fd);
+    }
+}
+
+// Mounts -v volumes and --tmpfs mounts. Runs after chroot, so container paths
+// (and any symlinks in them) resolve inside the container; volume sources were
+// opened on the host beforehand and are reached through /proc/self/fd.
+// SOURCE_FDS are closed on return, whether or not every mount succeeded.
+int mount_volumes(const Arguments& args, const std::vector<int>& source_fds) {
+    std::vector<MountSpec> mounts;
+    for (const auto& [specs, tmpfs] : {std::pair{&args.volumes, false}, std::pair{&args.tmpfs_mounts, true}}) {
+        for (const auto& spec : *specs) {
+            MountSpec mount_spec;
+            std::string error;
+            parse_mount_spec(spec, tmpfs, mount_spec, error);
+            mounts.push_back(mount_spec);
         }
-        
-        created = false;
     }
     
-private:
-    long long parse_memory_limit(const std::string& limit) {
-        if (limit.empty()) return -1;
-        
-        std::string num_str = limit;
-        char unit = 'b';
+    int result = 0;
+    for (size_t i = 0; i < mounts.size(); i++) {
+        const MountSpec& m = mounts[i];
+        std::error_code ec;
         
-        if (!std::isdigit(limit.back())) {
-            unit = std::tolower(limit.back());
-            num_str = limit.substr(0, limit.length() - 1);
+        if (args.read_only && !std::filesystem::exists(m.target, ec)) {
+            std::cerr << "[CHILD] Mount point " << m.target << " must exist in the image with --read-only" << std::endl;
+            result = -1;
+            break;
         }
         
-        try {
-            long long num = std::stoll(num_str);
-            
-            switch (unit) {
-                case 'b': return num;
-                case 'k': return num * 1024LL;
-                case 'm': return num * 1024LL * 1024LL;
-                case 'g': return num * 1024LL * 1024LL * 1024LL;
-                default: return -1;
+        if (m.source.empty()) {
+            std::filesystem::create_directories(m.target, ec);
+            if (mount("tmpfs", m.target.c_str(), "tmpfs", m.flags, m.data.empty() ? nullptr : m.data.c_str()) != 0) {
+                perror(("Failed to mount tmpfs on " + m.target).c_str());
+                result = -1;
+                break;
             }
-        } catch (const std::exception& e) {
-            return -1;
+            std::cout << "[CHILD] Mounted tmpfs on " << m.target << std::endl;
+            continue;
+        }
+        
+        std::string source = "/proc/self/fd/" + std::to_string(source_fds[i]);
+        // A file can only be bind-mounted onto a file
+        if (std::filesystem::is_directory(source, ec)) {
+            std::filesystem::create_directories(m.target, ec);
+        } else {
+            std::filesystem::create_directories(std::filesystem::path(m.target).parent_path(), ec);
+            close(open(m.target.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+        }
+        
+        if (mount(source.c_str(), m.target.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
+            perror(("Failed to bind mount " + m.source + " on " + m.target).c_str());
+            result = -1;
+            break;
+        }
+        if ((m.flags & MS_RDONLY) && remount_read_only(m.target) != 0) {
+            result = -1;
+            break;
         }
+        std::cout << "[CHILD] Mounted " << m.source << " on " << m.target
+                  << ((m.flags & MS_RDONLY) ? " (read-only)" : "") << std::endl;
     }
-};
-
-// Legacy container filesystem setup (for backward compatibility)
-int setup_legacy_filesystem() {
-    std::cout << "[LEGACY] Setting up custom container filesystem" << std::endl;
-    
-    const char* rootfs = "/tmp/iza-rootfs";
     
-    // Remove and recreate rootfs
-    std::filesystem::remove_all(rootfs);
-    
-    if (mkdir(rootfs, 0755) != 0) {
-        perror("Failed to create rootfs directory");
+    close_fds(source_fds);
+    return result;
+}
+
+// Host directories a bind-mode rootfs is made of. Merged-/usr symlinks
+// (/bin -> usr/bin) are recreated as symlinks instead of mounted.
+const std::vector<std::string> bind_rootfs_dirs = {"/usr", "/bin", "/sbin", "/lib", "/lib32", "/lib64", "/libx32"};
+
+// Builds the container root in ROOT from read-only bind mounts of the host's
+// binary and library directories on top of a tmpfs. Runs in the child's
+// mount namespace: nothing is copied and everything vanishes with it.
+int assemble_bind_rootfs(const std::string& root) {
+    if (mount("tmpfs", root.c_str(), "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755,size=64m") != 0) {
+        perror("Failed to mount rootfs tmpfs");
         return -1;
     }
     
-    // Create essential directories
-    std::vector<std::string> dirs = {
-        "/bin", "/usr", "/usr/bin", "/etc", "/proc", "/tmp", "/dev",
-        "/lib", "/lib64", "/lib/x86_64-linux-gnu", "/usr/lib", "/usr/lib/x86_64-linux-gnu"
-    };
-    
-    for (const auto& dir : dirs) {
-        std::string full_path = std::string(rootfs) + dir;
-        std::filesystem::create_directories(full_path);
-    }
-    
-    // Copy essential binaries
-    std::vector<std::pair<std::string, std::string>> binaries = {
-        {"/bin/bash", "/bin/bash"},
-        {"/bin/ls", "/bin/ls"},
-        {"/bin/ps", "/bin/ps"},
-        {"/usr/bin/whoami", "/usr/bin/whoami"},
-        {"/bin/cat", "/bin/cat"},
-        {"/usr/bin/stress", "/usr/bin/stress"},
-        {"/bin/sh", "/bin/sh"},
-        {"/bin/hostname", "/bin/hostname"}
-    };
+    for (const char* dir : {"/proc", "/tmp", "/dev", "/dev/shm", "/etc"}) {
+        mkdir((root + dir).c_str(), 0755);
+    }
     
-    for (const auto& [src, dst] : binaries) {
-        std::string dst_path = std::string(rootfs) + dst;
-        std::ifstream source(src, std::ios::binary);
-        if (source.is_open()) {
-            std::ofstream dest(dst_path, std::ios::binary);
-            dest << source.rdbuf();
-            chmod(dst_path.c_str(), 0755);
+    for (const auto& dir : bind_rootfs_dirs) {
+        struct stat st;
+        if (lstat(dir.c_str(), &st) != 0) continue;
+        std::string target = root + dir;
+        
+        if (S_ISLNK(st.st_mode)) {
+            std::error_code ec;
+            auto link = std::filesystem::read_symlink(dir, ec);
+            if (ec || symlink(link.c_str(), target.c_str()) != 0) {
+                perror(("Failed to recreate symlink " + dir).c_str());
+                return -1;
+            }
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode)) continue;
+        
+        mkdir(target.c_str(), 0755);
+        if (mount(dir.c_str(), target.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
+            perror(("Failed to bind mount " + dir).c_str());
+            return -1;
+        }
+        if (remount_read_only(target) != 0) {
+            return -1;
         }
     }
     
-    // Create basic /etc files
-    std::string hostname_file = std::string(rootfs) + "/etc/hostname";
-    std::ofstream hostname(hostname_file);
-    if (hostname.is_open()) {
-        hostname << "iza-container" << std::endl;
-        hostname.close();
-    }
+    std::ofstream hostname(root + "/etc/hostname");
+    hostname << "iza-container" << std::endl;
     
+    std::cout << "[CHILD] Assembled rootfs from " << bind_rootfs_dirs.size() << " read-only host directories" << std::endl;
     return 0;
 }
 
 int container_child(void* arg) {
     Arguments* args = static_cast<Arguments*>(arg);
     
+    // Wait until the parent has written our ID maps and moved us into the cgroup.
+    // clone() copied the write end too; while we hold it a dead parent
+    // would leave the read blocked instead of returning EOF
+    char* env_sync = getenv("IZA_SYNC_FD");
+    if (env_sync != nullptr) {
+        char* env_sync_write = getenv("IZA_SYNC_WRITE_FD");
+        if (env_sync_write != nullptr) close(atoi(env_sync_write));
+        char ready;
+        if (read(atoi(env_sync), &ready, 1) != 1) {
+            std::cerr << "[CHILD] Parent failed to set up the container" << std::endl;
+            return -1;
+        }
+    }
+    
     std::cout << "[CHILD] Container process starting (PID: " << getpid() << ")" << std::endl;
     
     // Set hostname
@@ -748,6 +7546,28 @@ int container_child(void* arg) {
         std::cout << "[CHILD] Using legacy rootfs: " << rootfs_path << std::endl;
     }
     
+    // Keep mounts made from here on out of the host's namespace
+    if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) != 0) {
+        perror("Failed to make mounts private");
+    }
+    
+    if (args->rootfs_mode == "bind" && args->image_name.empty()) {
+        if (assemble_bind_rootfs(rootfs_path) != 0) {
+            return -1;
+        }
+        if (args->read_only && mount(nullptr, rootfs_path.c_str(), nullptr, MS_REMOUNT | MS_RDONLY | MS_NOSUID | MS_NODEV, nullptr) != 0) {
+            perror("Failed to make rootfs read-only");
+            return -1;
+        }
+    }
+    
+    // The storage driver's in-namespace half: rootless overlays, read-only snapshots
+    char* env_driver = getenv("IZA_STORAGE_DRIVER");
+    if (env_driver != nullptr && !(args->rootfs_mode == "bind" && args->image_name.empty()) &&
+        make_storage_driver(env_driver)->mount(rootfs_path, args->read_only) != 0) {
+        return -1;
+    }
+    
     // Verify the rootfs directory exists
     if (!std::filesystem::exists(rootfs_path)) {
         std::cerr << "[CHILD] ERROR: Rootfs directory does not exist: " << rootfs_path << std::endl;
@@ -760,18 +7580,35 @@ int container_child(void* arg) {
         return -1;
     }
     
+    // Volume sources are host paths: open them before chroot hides the host
+    std::vector<int> volume_fds;
+    for (const auto& spec : args->volumes) {
+        MountSpec mount_spec;
+        std::string error;
+        parse_mount_spec(spec, false, mount_spec, error);
+        int fd = open(mount_spec.source.c_str(), O_PATH | O_CLOEXEC);
+        if (fd < 0) {
+            perror(("Failed to open volume " + mount_spec.source).c_str());
+            close_fds(volume_fds);
+            return -1;
+        }
+        volume_fds.push_back(fd);
+    }
+    
     std::cout << "[CHILD] Changing root to: " << rootfs_path << std::endl;
     
     // Change root to our container filesystem
     if (chroot(rootfs_path.c_str()) != 0) {
         perror("Failed to chroot");
         std::cerr << "Attempted path: " << rootfs_path << std::endl;
+        close_fds(volume_fds);
         return -1;
     }
     
     // Change to root directory inside the container
     if (chdir("/") != 0) {
         perror("Failed to change directory to /");
+        close_fds(volume_fds);
         return -1;
     }
     
@@ -780,9 +7617,18 @@ int container_child(void* arg) {
         perror("Failed to mount /proc");
     }
     
-    // Mount /tmp filesystem
-    if (mount("tmpfs", "/tmp", "tmpfs", 0, nullptr) != 0) {
-        perror("Failed to mount /tmp");
+    // /tmp and /dev/shm are charged to the container's memory, so both are capped
+    std::string tmp_options = "mode=1777";
+    if (!args->tmp_size.empty()) tmp_options += ",size=" + args->tmp_size;
+    mount_tmpfs("/tmp", MS_NOSUID | MS_NODEV, tmp_options, args->tmpfs_huge);
+    
+    // POSIX shared memory (shm_open, multiprocessing, PostgreSQL) lives here
+    std::error_code shm_ec;
+    std::filesystem::create_directories("/dev/shm", shm_ec);
+    mount_tmpfs("/dev/shm", MS_NOSUID | MS_NODEV | MS_NOEXEC, "mode=1777,size=" + args->shm_size, args->tmpfs_huge);
+    
+    if (mount_volumes(*args, volume_fds) != 0) {
+        return -1;
     }
     
     std::cout << "[CHILD] Container environment ready. Executing: ";
@@ -807,31 +7653,88 @@ int container_child(void* arg) {
     return 0;
 }
 
-int main(int argc, char* argv[]) {
-    std::cout << "🎯 Iza Container Runtime - Phase 3: Image Management" << std::endl;
-    std::cout << "====================================================" << std::endl;
+// Picks the storage driver (--storage-driver, IZA_STORAGE_DRIVER or auto) and
+// prepares the container's root with it. An auto-selected overlay that fails
+// to mount falls back to reflinks or copying.
+int prepare_storage(const Arguments& args, const std::vector<std::string>& lower_dirs,
+                    const std::string& container_id, std::string& rootfs,
+                    std::unique_ptr<StorageDriver>& storage) {
+    const char* env_driver = getenv("IZA_STORAGE_DRIVER");
+    std::string requested = !args.storage_driver.empty() ? args.storage_driver
+                          : env_driver != nullptr ? env_driver : "auto";
+    storage = make_storage_driver(requested, args.overlay_opts);
+    std::cout << "[STORAGE] Using the " << storage->name() << " driver" << std::endl;
     
-    // Initialize curl
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (storage->prepare(lower_dirs, container_id, rootfs, args.read_only) != 0) {
+        if (storage->name() != "overlay" || requested == "overlay") {
+            return -1;
+        }
+        std::string fallback = reflink_supported(iza_storage_root()) ? "reflink" : "copy";
+        std::cout << "[WARNING] OverlayFS mount failed, falling back to the " << fallback << " driver" << std::endl;
+        storage = make_storage_driver(fallback);
+        if (storage->prepare(lower_dirs, container_id, rootfs, args.read_only) != 0) {
+            return -1;
+        }
+    }
     
+    // The container finishes the job with the same driver
+    setenv("IZA_STORAGE_DRIVER", storage->name().c_str(), 1);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     // Parse command line arguments
     Arguments args;
     if (!args.parse(argc, argv)) {
-        curl_global_cleanup();
         return 1;
     }
     
+    // Keep machine-readable output clean
+    if (args.output_format != "json") {
+        std::cout << "🎯 Iza Container Runtime - Phase 3: Image Management" << std::endl;
+        std::cout << "====================================================" << std::endl;
+    }
+    
+    if (args.command_type == "stats") {
+        return stats_command(args);
+    } else if (args.command_type == "slice") {
+        return slice_command(args);
+    } else if (args.command_type == "prune") {
+        return prune_command(args);
+    } else if (args.command_type == "update") {
+        return update_command(args);
+    } else if (args.command_type == "pause" || args.command_type == "resume") {
+        return pause_command(args);
+    } else if (args.command_type == "pool") {
+        return pool_command(args);
+    } else if (args.command_type == "commit") {
+        return commit_command(args);
+    } else if (args.command_type == "diff") {
+        return diff_command(args);
+    }
+    
+    // Initialize curl
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    
     ImageManager image_manager;
     
     // Handle different commands
     if (args.command_type == "pull") {
-        int result = image_manager.pull_image(args.image_name);
+        int result = image_manager.pull_image(args.image_name, args.image_format, args.image_url);
         curl_global_cleanup();
         return result;
     } else if (args.command_type == "images") {
         int result = image_manager.list_images();
         curl_global_cleanup();
         return result;
+    } else if (args.command_type == "topology") {
+        HostTopology topology;
+        int result = topology.load();
+        if (result == 0) {
+            topology.print();
+        }
+        curl_global_cleanup();
+        return result == 0 ? 0 : 1;
     }
     
     // Handle "run" command
@@ -854,23 +7757,28 @@ int main(int argc, char* argv[]) {
     
     // Set up filesystem
     std::string container_rootfs;
-    OverlayFS overlay;
+    std::string container_lower;
+    std::unique_ptr<StorageDriver> storage;  // None for --rootfs-mode bind
     std::string container_id = "container-" + std::to_string(getpid()) + "-" + std::to_string(time(nullptr));
+    auto cleanup_storage = [&]() {
+        if (storage) storage->cleanup(container_id);
+    };
     
     if (!args.image_name.empty()) {
         // Use image-based container
-        std::string image_rootfs = image_manager.get_image_rootfs(args.image_name);
-        if (image_rootfs.empty()) {
+        std::vector<std::string> image_layers = image_manager.get_image_layers(args.image_name);
+        if (image_layers.empty()) {
             std::cerr << "Error: Image '" << args.image_name << "' not found. Try: iza pull " << args.image_name << std::endl;
             curl_global_cleanup();
             return 1;
         }
         
         std::cout << "[FILESYSTEM] Using image: " << args.image_name << std::endl;
+        container_lower = OverlayFS::join_lower_dirs(image_layers);
         
-        // Set up overlay filesystem
-        if (overlay.setup_overlay(image_rootfs, container_id, container_rootfs) != 0) {
-            std::cerr << "Failed to set up overlay filesystem" << std::endl;
+        // Set up the container's root filesystem
+        if (prepare_storage(args, image_layers, container_id, container_rootfs, storage) != 0) {
+            std::cerr << "Failed to set up container filesystem" << std::endl;
             curl_global_cleanup();
             return 1;
         }
@@ -888,7 +7796,7 @@ int main(int argc, char* argv[]) {
         std::filesystem::remove(child_rootfs); // Remove if exists
         if (symlink(container_rootfs.c_str(), child_rootfs.c_str()) != 0) {
             perror("Failed to create rootfs symlink");
-            overlay.cleanup_overlay(container_id);
+            cleanup_storage();
             curl_global_cleanup();
             return 1;
         }
@@ -896,69 +7804,108 @@ int main(int argc, char* argv[]) {
         // Set environment variable for child process
         setenv("IZA_ROOTFS_PATH", container_rootfs.c_str(), 1);
         
+    } else if (args.rootfs_mode == "bind") {
+        // The child mounts the rootfs over this empty directory in its own namespace
+        container_rootfs = "/tmp/iza-container-" + std::to_string(getpid());
+        std::filesystem::remove(container_rootfs);
+        if (mkdir(container_rootfs.c_str(), 0755) != 0) {
+            perror("Failed to create rootfs mount point");
+            curl_global_cleanup();
+            return 1;
+        }
+        setenv("IZA_ROOTFS_PATH", container_rootfs.c_str(), 1);
     } else {
-        // Use legacy custom filesystem
-        if (setup_legacy_filesystem() != 0) {
+        // Legacy custom filesystem: the cached tree is shared, so it goes through a storage driver too
+        std::string legacy_rootfs;
+        if (setup_legacy_filesystem(legacy_rootfs) != 0) {
             std::cerr << "Failed to set up legacy container filesystem" << std::endl;
             curl_global_cleanup();
             return 1;
         }
-        container_rootfs = "/tmp/iza-rootfs";
+        
+        container_lower = OverlayFS::join_lower_dirs({legacy_rootfs});
+        if (prepare_storage(args, {legacy_rootfs}, container_id, container_rootfs, storage) != 0) {
+            std::cerr << "Failed to set up container filesystem" << std::endl;
+            curl_global_cleanup();
+            return 1;
+        }
         // Set environment variable for child process
         setenv("IZA_ROOTFS_PATH", container_rootfs.c_str(), 1);
     }
     
+    // Register the container so other iza commands can find it
+    ContainerRegistry registry;
+    ContainerRecord record;
+    record.id = container_id;
+    record.supervisor_pid = getpid();
+    record.supervisor_start = process_start_time(getpid());
+    record.image = args.image_name;
+    record.rootfs = container_rootfs;
+    record.lower = container_lower;
+    record.driver = storage ? storage->name() : "";
+    record.base = storage ? storage->base() : "";
+    record.started = time(nullptr);
+    record.pool = args.pool_name;
+    if (!args.pool_name.empty()) {
+        record.state = "warming";
+    }
+    
     // Create and configure cgroup (if limits specified)
     CgroupManager cgroup;
-    bool use_cgroups = !args.memory_limit.empty() || !args.cpu_limit.empty();
+    cgroup.set_parent(args.cgroup_parent);
+    // Pool members are frozen through their cgroup, so they always get one
+    bool use_cgroups = args.has_resource_limits() || !args.pool_name.empty();
     
-    if (use_cgroups) {
+    if (!use_cgroups && CgroupManager::available()) {
+        // No limits requested, but a cgroup still gives "iza stats" something to read
+        if (cgroup.create_cgroup() == 0) {
+            use_cgroups = true;
+            record.cgroup_path = cgroup.path();
+        } else {
+            std::cout << "[CGROUP] Warning: running without a cgroup, usage stats unavailable" << std::endl;
+        }
+    } else if (use_cgroups) {
         std::cout << "[CGROUP] Setting up resource limits..." << std::endl;
         
         if (cgroup.create_cgroup() != 0) {
             std::cerr << "Failed to create cgroup" << std::endl;
-            if (!args.image_name.empty()) {
-                overlay.cleanup_overlay(container_id);
-                std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
-            }
+            cleanup_storage();
+            std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
             curl_global_cleanup();
             return 1;
         }
+        record.cgroup_path = cgroup.path();
         
-        if (!args.memory_limit.empty()) {
-            if (cgroup.set_memory_limit(args.memory_limit) != 0) {
-                std::cerr << "Failed to set memory limit" << std::endl;
-                if (!args.image_name.empty()) {
-                    overlay.cleanup_overlay(container_id);
-                    std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
-                }
-                curl_global_cleanup();
-                return 1;
-            }
+        if (args.cpuset_mode == "auto" && allocate_cpuset(args, registry, record) != 0) {
+            cleanup_storage();
+            std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
+            curl_global_cleanup();
+            return 1;
         }
         
-        if (!args.cpu_limit.empty()) {
-            if (cgroup.set_cpu_limit(args.cpu_limit) != 0) {
-                std::cerr << "Failed to set CPU limit" << std::endl;
-                if (!args.image_name.empty()) {
-                    overlay.cleanup_overlay(container_id);
-                    std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
-                }
-                curl_global_cleanup();
-                return 1;
-            }
+        if (apply_resource_limits(cgroup, args) != 0) {
+            cleanup_storage();
+            std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
+            curl_global_cleanup();
+            return 1;
         }
     }
     
+    record.cpus = args.cpuset_cpus;
+    record.mems = args.cpuset_mems;
+    
+    // --cpuset auto already saved the record under the registry lock
+    if (args.cpuset_mode != "auto") {
+        registry.save(record);
+    }
+    
     // Allocate stack for child process
     const size_t stack_size = 1024 * 1024; // 1MB stack
     void* stack = malloc(stack_size);
     if (!stack) {
         perror("Failed to allocate stack");
-        if (!args.image_name.empty()) {
-            overlay.cleanup_overlay(container_id);
-            std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
-        }
+        cleanup_storage();
+        std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
         curl_global_cleanup();
         return 1;
     }
@@ -972,25 +7919,53 @@ int main(int argc, char* argv[]) {
                      CLONE_NEWIPC |     // New IPC namespace
                      CLONE_NEWNET |     // New network namespace
                      SIGCHLD;           // Send SIGCHLD on termination
+    if (UserNamespace::rootless()) {
+        clone_flags |= CLONE_NEWUSER;   // Rootless: we are root only inside it
+    }
+    
+    // The child blocks on this pipe until its ID maps and cgroup are in place
+    int sync_pipe[2];
+    if (pipe2(sync_pipe, O_CLOEXEC) != 0) {
+        perror("Failed to create sync pipe");
+        free(stack);
+        registry.remove(container_id);
+        cleanup_storage();
+        std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
+        curl_global_cleanup();
+        return 1;
+    }
+    setenv("IZA_SYNC_FD", std::to_string(sync_pipe[0]).c_str(), 1);
+    setenv("IZA_SYNC_WRITE_FD", std::to_string(sync_pipe[1]).c_str(), 1);
     
     std::cout << "[CONTAINER] Creating container with clone()..." << std::endl;
     
     // Create the container process
     pid_t container_pid = clone(container_child, stack_top, clone_flags, &args);
+    close(sync_pipe[0]);
+    
+    if (container_pid != -1 && UserNamespace::rootless() && UserNamespace::setup_id_maps(container_pid) != 0) {
+        std::cerr << "Failed to set up user namespace ID maps" << std::endl;
+        kill(container_pid, SIGKILL);
+        waitpid(container_pid, nullptr, 0);
+        container_pid = -1;
+    }
     
     if (container_pid == -1) {
         perror("Failed to create container process");
+        close(sync_pipe[1]);
         free(stack);
-        if (!args.image_name.empty()) {
-            overlay.cleanup_overlay(container_id);
-            std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
-        }
+        registry.remove(container_id);
+        cleanup_storage();
+        std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
         curl_global_cleanup();
         return 1;
     }
     
     std::cout << "[PARENT] Container started with PID: " << container_pid << std::endl;
     
+    record.container_pid = container_pid;
+    registry.save(record);
+    
     // Add process to cgroup if we're using resource limits
     if (use_cgroups) {
         if (cgroup.add_process(container_pid) != 0) {
@@ -1000,29 +7975,74 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    // Let the container start
+    if (write(sync_pipe[1], "1", 1) != 1) {
+        perror("Failed to start container");
+    }
+    close(sync_pipe[1]);
+    
     // Wait for container to finish
     int status;
     std::cout << "[PARENT] Waiting for container to finish..." << std::endl;
     
-    if (waitpid(container_pid, &status, 0) == -1) {
+    std::unique_ptr<ContainerSupervisor> supervisor;
+    pid_t waited;
+    if (use_cgroups) {
+        supervisor = std::make_unique<ContainerSupervisor>(cgroup.path(), container_pid,
+                                                           args.pressure_threshold, args.pressure_action);
+        supervisor->start();
+        
+        std::unique_ptr<CpuQuotaController> cpu_controller = make_cpu_controller(args, cgroup.path());
+        if (cpu_controller && cpu_controller->start() == 0) {
+            supervisor->on_tick([&cpu_controller]() { cpu_controller->tick(); });
+        }
+        
+        std::unique_ptr<MemoryReclaimer> reclaimer = make_memory_reclaimer(args, cgroup);
+        if (reclaimer && reclaimer->start() == 0) {
+            supervisor->on_tick([&reclaimer]() { reclaimer->tick(); });
+        }
+        
+        if (!args.pool_name.empty()) {
+            // Warm pool member: freeze once the entrypoint is ready, "iza pool take" thaws it
+            supervisor->on_tick([&]() {
+                if (record.state != "warming" || !pool_member_ready(container_pid, args.ready_file)) return;
+                if (cgroup.set_frozen(true) != 0) return;
+                
+                // Reload under the lock: "iza update" may have changed cpus/mems since start
+                if (registry.lock() != 0) return;
+                ContainerRecord current;
+                if (registry.find(record.id, current) == 0) {
+                    current.state = "pooled";
+                    registry.save(current);
+                }
+                registry.unlock();
+                record.state = "pooled";
+                std::cout << "[POOL] " << record.id << " is ready and frozen in pool " << args.pool_name << std::endl;
+            });
+        }
+        
+        waited = supervisor->wait(status);
+    } else {
+        waited = waitpid(container_pid, &status, 0);
+    }
+    
+    if (waited == -1) {
         perror("Failed to wait for container");
         free(stack);
-        if (!args.image_name.empty()) {
-            overlay.cleanup_overlay(container_id);
-            std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
-        }
+        registry.remove(container_id);
+        cleanup_storage();
+        std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
         curl_global_cleanup();
         return 1;
     }
     
     // Cleanup
     free(stack);
+    registry.remove(container_id);
     
-    if (!args.image_name.empty()) {
-        std::cout << "[CLEANUP] Cleaning up overlay filesystem..." << std::endl;
-        overlay.cleanup_overlay(container_id);
-        std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
-    }
+    std::cout << "[CLEANUP] Cleaning up container filesystem..." << std::endl;
+    cleanup_storage();
+    std::filesystem::remove("/tmp/iza-container-" + std::to_string(getpid()));
     
     curl_global_cleanup();
     
@@ -1033,7 +8053,15 @@ int main(int argc, char* argv[]) {
         return exit_code;
     } else if (WIFSIGNALED(status)) {
         int signal = WTERMSIG(status);
-        std::cout << "[PARENT] Container killed by signal: " << signal << std::endl;
+        if (signal == SIGKILL && supervisor && supervisor->oom_killed()) {
+            std::cout << "[PARENT] Container was OOM-killed: memory.max exceeded";
+            if (!args.memory_limit.empty()) {
+                std::cout << " (limit " << args.memory_limit << ")";
+            }
+            std::cout << std::endl;
+        } else {
+            std::cout << "[PARENT] Container killed by signal: " << signal << std::endl;
+        }
         return 128 + signal;
     }
     